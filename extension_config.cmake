@@ -7,4 +7,7 @@ duckdb_extension_load(stata_dta
 )
 
 # Any extra extensions that should be built
-# e.g.: duckdb_extension_load(json)
\ No newline at end of file
+# e.g.: duckdb_extension_load(json)
+
+# Parquet copies written for read_stata_dta's cache_dir
+duckdb_extension_load(parquet)
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "duckdb.hpp"
+#include "duckdb/catalog/catalog.hpp"
+#include "duckdb/catalog/catalog_entry/schema_catalog_entry.hpp"
+#include "duckdb/catalog/catalog_entry/table_catalog_entry.hpp"
+#include "duckdb/storage/storage_extension.hpp"
+#include "duckdb/transaction/transaction.hpp"
+#include "duckdb/transaction/transaction_manager.hpp"
+
+namespace duckdb {
+
+// ATTACH 'directory' AS name (TYPE stata): a read-only catalog with one table per
+// .dta, .dta.gz or .dta.zst file in the directory, named after the file.
+// Nothing is read when attaching. A table's schema is read from the file header
+// the first time it is referenced and cached until the file's size or
+// modification time changes.
+class StataStorageExtension : public StorageExtension {
+public:
+	StataStorageExtension();
+};
+
+class StataTableEntry : public TableCatalogEntry {
+public:
+	StataTableEntry(Catalog &catalog, SchemaCatalogEntry &schema, CreateTableInfo &info, std::string filename,
+	                uint64_t nobs);
+
+	unique_ptr<BaseStatistics> GetStatistics(ClientContext &context, column_t column_id) override;
+	TableFunction GetScanFunction(ClientContext &context, unique_ptr<FunctionData> &bind_data) override;
+	TableStorageInfo GetStorageInfo(ClientContext &context) override;
+
+	const std::string &GetFilename() const {
+		return filename_;
+	}
+
+private:
+	std::string filename_;
+	uint64_t nobs_;
+};
+
+class StataSchemaEntry : public SchemaCatalogEntry {
+public:
+	StataSchemaEntry(Catalog &catalog, CreateSchemaInfo &info, std::string directory);
+
+	optional_ptr<CatalogEntry> LookupEntry(CatalogTransaction transaction, const EntryLookupInfo &lookup_info) override;
+	void Scan(ClientContext &context, CatalogType type, const std::function<void(CatalogEntry &)> &callback) override;
+	void Scan(CatalogType type, const std::function<void(CatalogEntry &)> &callback) override;
+
+	optional_ptr<CatalogEntry> CreateIndex(CatalogTransaction transaction, CreateIndexInfo &info,
+	                                       TableCatalogEntry &table) override;
+	optional_ptr<CatalogEntry> CreateFunction(CatalogTransaction transaction, CreateFunctionInfo &info) override;
+	optional_ptr<CatalogEntry> CreateTable(CatalogTransaction transaction, BoundCreateTableInfo &info) override;
+	optional_ptr<CatalogEntry> CreateView(CatalogTransaction transaction, CreateViewInfo &info) override;
+	optional_ptr<CatalogEntry> CreateSequence(CatalogTransaction transaction, CreateSequenceInfo &info) override;
+	optional_ptr<CatalogEntry> CreateTableFunction(CatalogTransaction transaction,
+	                                               CreateTableFunctionInfo &info) override;
+	optional_ptr<CatalogEntry> CreateCopyFunction(CatalogTransaction transaction,
+	                                              CreateCopyFunctionInfo &info) override;
+	optional_ptr<CatalogEntry> CreatePragmaFunction(CatalogTransaction transaction,
+	                                                CreatePragmaFunctionInfo &info) override;
+	optional_ptr<CatalogEntry> CreateCollation(CatalogTransaction transaction, CreateCollationInfo &info) override;
+	optional_ptr<CatalogEntry> CreateType(CatalogTransaction transaction, CreateTypeInfo &info) override;
+	void DropEntry(ClientContext &context, DropInfo &info) override;
+	void Alter(CatalogTransaction transaction, AlterInfo &info) override;
+
+private:
+	struct CachedTable {
+		uint64_t size;
+		int64_t mtime;
+		unique_ptr<StataTableEntry> entry;
+	};
+	// An entry replaced after its file changed. Transactions that started before
+	// retired_at may have bound it and still run; later ones never see it.
+	struct RetiredTable {
+		transaction_t retired_at;
+		unique_ptr<StataTableEntry> entry;
+	};
+
+	std::string directory_;
+	mutex lock_;
+	// Tables by lower-case name
+	case_insensitive_map_t<CachedTable> tables_;
+	vector<RetiredTable> retired_;
+
+	// Data files in the directory by table name
+	case_insensitive_map_t<std::string> ListFiles() const;
+	// Path of the table's file, or "" if there is none
+	std::string FindFile(const std::string &name) const;
+	optional_ptr<StataTableEntry> GetTable(optional_ptr<ClientContext> context, const std::string &name,
+	                                       const std::string &filename);
+	// Drops retired entries no running transaction can refer to. Called with lock_ held.
+	void ReleaseRetired();
+};
+
+class StataCatalog : public Catalog {
+public:
+	StataCatalog(AttachedDatabase &db, std::string directory);
+
+	void Initialize(bool load_builtin) override;
+	string GetCatalogType() override {
+		return "stata";
+	}
+
+	optional_ptr<CatalogEntry> CreateSchema(CatalogTransaction transaction, CreateSchemaInfo &info) override;
+	void ScanSchemas(ClientContext &context, std::function<void(SchemaCatalogEntry &)> callback) override;
+	optional_ptr<SchemaCatalogEntry> LookupSchema(CatalogTransaction transaction, const EntryLookupInfo &schema_lookup,
+	                                              OnEntryNotFound if_not_found) override;
+
+	PhysicalOperator &PlanCreateTableAs(ClientContext &context, PhysicalPlanGenerator &planner, LogicalCreateTable &op,
+	                                    PhysicalOperator &plan) override;
+	PhysicalOperator &PlanInsert(ClientContext &context, PhysicalPlanGenerator &planner, LogicalInsert &op,
+	                             optional_ptr<PhysicalOperator> plan) override;
+	PhysicalOperator &PlanDelete(ClientContext &context, PhysicalPlanGenerator &planner, LogicalDelete &op,
+	                             PhysicalOperator &plan) override;
+	PhysicalOperator &PlanUpdate(ClientContext &context, PhysicalPlanGenerator &planner, LogicalUpdate &op,
+	                             PhysicalOperator &plan) override;
+	unique_ptr<LogicalOperator> BindCreateIndex(Binder &binder, CreateStatement &stmt, TableCatalogEntry &table,
+	                                            unique_ptr<LogicalOperator> plan) override;
+
+	DatabaseSize GetDatabaseSize(ClientContext &context) override;
+	bool InMemory() override {
+		return false;
+	}
+	string GetDBPath() override {
+		return directory_;
+	}
+
+private:
+	void DropSchema(ClientContext &context, DropInfo &info) override;
+
+	std::string directory_;
+	unique_ptr<StataSchemaEntry> main_schema_;
+};
+
+// Nothing is written, so transactions only need to exist and be ordered
+class StataTransaction : public Transaction {
+public:
+	StataTransaction(TransactionManager &manager, ClientContext &context, transaction_t start)
+	    : Transaction(manager, context), start(start) {
+	}
+
+	// Position in the order transactions started in
+	transaction_t start;
+};
+
+class StataTransactionManager : public TransactionManager {
+public:
+	explicit StataTransactionManager(AttachedDatabase &db) : TransactionManager(db) {
+	}
+
+	Transaction &StartTransaction(ClientContext &context) override;
+	ErrorData CommitTransaction(ClientContext &context, Transaction &transaction) override;
+	void RollbackTransaction(Transaction &transaction) override;
+	void Checkpoint(ClientContext &context, bool force = false) override {
+	}
+
+	// Start of the next transaction; every running one started before it
+	transaction_t NextStart();
+	// Start of the oldest running transaction, or NextStart() if none is running
+	transaction_t OldestStart();
+
+private:
+	mutex lock_;
+	transaction_t next_start_ = 0;
+	reference_map_t<Transaction, unique_ptr<StataTransaction>> transactions_;
+};
+
+} // namespace duckdb
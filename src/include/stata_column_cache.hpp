@@ -0,0 +1,169 @@
+#pragma once
+
+#include "duckdb.hpp"
+#include "duckdb/main/client_context_state.hpp"
+#include "duckdb/storage/object_cache.hpp"
+#include <condition_variable>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace duckdb {
+
+// Decoded values of one variable in one row group: rows validity bytes, then
+// rows fixed-width values, or for strings rows uint32 lengths followed by the bytes
+struct StataCachedValues {
+    LogicalType type;
+    idx_t rows = 0;
+    idx_t bytes = 0;
+    AllocatedData data;
+
+    // Size of count values of source once encoded
+    static idx_t EncodedSize(Vector& source, idx_t count);
+    // Encodes count values of source, of EncodedSize bytes; false if memory is short
+    bool Encode(Allocator& allocator, Vector& source, idx_t count, idx_t size);
+    // Copies the first count values into result; false if there are fewer or their type differs
+    bool Decode(idx_t count, Vector& result) const;
+};
+
+// Decoded variables of recently scanned row groups, shared by all queries on a
+// database. Entries are keyed by file fingerprint (absolute path, size and
+// modification time), variable and row group, and evicted least recently used
+// first once the stata_column_cache_size setting is exceeded. Their memory is
+// allocated through DuckDB's buffer allocator, so it counts against the memory
+// limit.
+class StataColumnCache : public ObjectCacheEntry {
+public:
+    // Rows per row group; row groups start at multiples of this
+    static constexpr idx_t ROW_GROUP_SIZE = STANDARD_VECTOR_SIZE;
+
+    explicit StataColumnCache(Allocator& allocator);
+
+    // The database's cache, resized to the current setting. nullptr while the
+    // setting is 0.
+    static shared_ptr<StataColumnCache> Get(ClientContext& context);
+    static std::string Fingerprint(const std::string& path);
+
+    static string ObjectType() {
+        return "stata_column_cache";
+    }
+    string GetObjectType() override {
+        return ObjectType();
+    }
+
+    // Copies count cached values of the row group starting at first_row into
+    // result; false if they are not cached
+    bool Fetch(const std::string& fingerprint, idx_t column, idx_t first_row, idx_t count, Vector& result);
+    // Records count decoded values of the row group starting at first_row
+    void Store(const std::string& fingerprint, const std::string& filename, const std::string& variable, idx_t column,
+               idx_t first_row, idx_t count, Vector& source);
+
+    struct EntryInfo {
+        std::string filename;
+        std::string variable;
+        idx_t first_row;
+        idx_t rows;
+        idx_t bytes;
+    };
+    // Entries from most to least recently used
+    std::vector<EntryInfo> GetEntries();
+    void SetCapacity(idx_t capacity);
+
+private:
+    struct Entry {
+        EntryInfo info;
+        StataCachedValues values;
+    };
+    typedef std::list<std::pair<std::string, shared_ptr<Entry>>> lru_list_t;
+
+    Allocator& allocator_;
+    mutex lock_;
+    idx_t capacity_ = 0;
+    idx_t size_ = 0;
+    lru_list_t lru_;
+    std::unordered_map<std::string, lru_list_t::iterator> entries_;
+
+    // Drops least recently used entries until size_ fits. Called with the lock held.
+    void Evict();
+};
+
+// Files that more than one scan of the running query reads, e.g. both sides of
+// a self-join or several CTEs over the same panel. The first of those scans to
+// decode a row group of a variable keeps it for the others, which copy it
+// instead of reading the file again. A kept row group is dropped as soon as
+// every other scan that reads the variable has copied it or finished, so it is
+// never pushed out before a slower scan gets to it; once the cap is reached,
+// further row groups are not kept and the other scans decode them themselves.
+// While one scan decodes a row group, the others wait for it rather than
+// decoding it too. Everything is dropped when the query ends.
+class StataSharedScans : public ClientContextState {
+public:
+    StataSharedScans(Allocator& allocator, idx_t capacity);
+
+    static shared_ptr<StataSharedScans> Get(ClientContext& context);
+
+    // Called for each file when a scan is bound; returns the scan's number among those of path
+    idx_t Register(const std::string& path);
+    // Whether path is read by more than one scan
+    bool IsShared(const std::string& path);
+    // Called once a scan knows the variables it reads; row groups of other
+    // variables are not kept for it
+    void SetProjection(const std::string& path, idx_t scan, const std::vector<idx_t>& columns);
+    // Called when a scan reads nothing more of path; row groups kept only for it are dropped
+    void Finish(const std::string& path, idx_t scan);
+
+    enum class FetchResult {
+        // The values were copied into result
+        FOUND,
+        // No other scan has them; with claim, this scan decodes them and must
+        // call Store or Abandon, and other scans wait for it meanwhile
+        DECODE,
+        // Another scan is decoding them; call Wait once this scan has stored
+        // what it decodes itself. Only returned with claim.
+        WAIT
+    };
+    FetchResult Fetch(const std::string& path, idx_t scan, idx_t column, idx_t first_row, idx_t count, Vector& result,
+                      bool claim);
+    // Keeps count decoded values of a claimed row group for the scans that have not read them
+    void Store(const std::string& path, idx_t scan, idx_t column, idx_t first_row, idx_t count, Vector& source);
+    // Releases a claimed row group without storing it
+    void Abandon(const std::string& path, idx_t column, idx_t first_row);
+    // Waits for the scan decoding a row group and copies it into result; false if it was not kept
+    bool Wait(const std::string& path, idx_t scan, idx_t column, idx_t first_row, idx_t count, Vector& result);
+
+    void QueryEnd(ClientContext& context) override;
+
+private:
+    struct File {
+        // Per scan: whether it is done, and once known, the variables it reads
+        std::vector<bool> finished;
+        std::vector<bool> projected;
+        std::vector<std::unordered_set<idx_t>> columns;
+    };
+    struct Slot {
+        std::string path;
+        idx_t column;
+        // Set while the claiming scan decodes the row group
+        bool decoding = true;
+        shared_ptr<StataCachedValues> values;
+        // Per scan, whether it has read the values or never will
+        std::vector<bool> read;
+    };
+
+    Allocator& allocator_;
+    idx_t capacity_;
+    mutex lock_;
+    std::condition_variable decoded_;
+    idx_t size_ = 0;
+    std::unordered_map<std::string, File> files_;
+    std::unordered_map<std::string, Slot> slots_;
+
+    // Marks slot as read by scan and drops it once every scan has; returns its
+    // values. Called with the lock held.
+    shared_ptr<StataCachedValues> MarkRead(const std::string& key, idx_t scan);
+    // Marks the slots of path that scan no longer needs as read by it. Called with the lock held.
+    void ReleaseSlots(const std::string& path, idx_t scan);
+};
+
+} // namespace duckdb
@@ -11,4 +11,15 @@ public:
 	std::string Version() const override;
 };
 
+// read_stata_dta, and its bind data for scanning one file; tables of attached
+// Stata directories are scanned through these. With a context, the schema is
+// read through the schema cache if the stata_schema_cache setting is set.
+TableFunction GetStataReadFunction();
+unique_ptr<FunctionData> StataBindFile(optional_ptr<ClientContext> context, const std::string &filename,
+                                       vector<LogicalType> &return_types, vector<string> &names);
+// Registers the files of a bound scan with the query's other scans of them, see StataSharedScans
+void StataRegisterScan(ClientContext &context, FunctionData &bind_data);
+// Number of observations in the file bound by StataBindFile
+idx_t StataBoundRowCount(const FunctionData &bind_data);
+
 } // namespace duckdb
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "duckdb.hpp"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace duckdb {
+
+// Key-to-row hash index over one variable, stored next to the Stata file as
+// <file>.<variable>.keyidx. The layout is flat so it can be memory-mapped:
+//
+//   header | uint64 bucket offsets[bucket_count + 1] | row numbers[rows]
+//
+// Row numbers of keys hashing to bucket b are entries [offsets[b], offsets[b + 1]).
+// Row numbers are 4 bytes wide, or 8 for files with more than 2^32 rows. The
+// header stamps the size, modification time, row count and a hash of the header
+// of the data file, and a stale index is ignored.
+class StataKeyIndex {
+public:
+    static std::string IndexPath(const std::string& data_path, const std::string& variable);
+    // Scans the variable and writes its index; returns the number of rows indexed.
+    // Memory is bounded: the data file is decoded once, and for large files the
+    // bucket of each row is spilled next to the index and reread instead.
+    static idx_t Build(const std::string& data_path, const std::string& variable);
+    // nullptr if the variable has no index or the index does not match the data
+    // file, which has nobs rows
+    static unique_ptr<StataKeyIndex> Open(const std::string& data_path, const std::string& variable, idx_t nobs);
+
+    // Rows that may hold one of the keys, sorted and unique. Hash collisions can
+    // add rows with other keys, so the caller still applies the filter.
+    std::vector<idx_t> Lookup(const vector<Value>& keys);
+
+    static uint64_t HashKey(const Value& key);
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t row_width;
+        uint64_t source_size;
+        int64_t source_mtime;
+        uint64_t source_header_hash;
+        uint64_t nobs;
+        uint64_t bucket_count;
+        uint64_t entry_count;
+    };
+
+    std::ifstream file_;
+    Header header_;
+
+    uint64_t ReadOffset(uint64_t bucket);
+};
+
+} // namespace duckdb
@@ -1,40 +1,62 @@
 #pragma once
 
 #include "duckdb.hpp"
-#include <fstream>
+#include "stata_stream.hpp"
 #include <string>
 #include <vector>
 #include <map>
 #include <memory>
+#include <unordered_map>
 
 namespace duckdb {
 
-enum class StataDataType : uint8_t {
-    STR1_244 = 1,   // String types 1-244
+enum class StataDataType : uint16_t {
+    STR1_244 = 1,   // Fixed-width string types (str1-str244, str2045 in 117+); width in str_len
     BYTE = 251,     // int8
     INT = 252,      // int16 
     LONG = 253,     // int32
     FLOAT = 254,    // float32
-    DOUBLE = 255    // float64
+    DOUBLE = 255,   // float64
+    STRL = 32768    // Long string (117+): 8-byte (v,o) reference into the <strls> section
+};
+
+// A strL of the <strls> section: its contents, or where to read them when they
+// were left in the input to bound memory
+struct StataStrLEntry {
+    uint64_t offset;
+    uint32_t length;
+    // Type 130 strings carry a trailing NUL that is not part of the value
+    bool null_terminated;
+    bool loaded;
+    std::string contents;
 };
 
 struct StataVariable {
     std::string name;
     StataDataType type;
-    uint8_t str_len;     // For string types
+    uint16_t str_len;    // For string types
     std::string format;
     std::string label;
     std::string value_label_name;
 };
 
+// Characteristic from <characteristics> (expansion fields before format 117);
+// variable is "_dta" for the dataset itself. Notes are stored as note0, note1, ...
+struct StataCharacteristic {
+    std::string variable;
+    std::string name;
+    std::string contents;
+};
+
 struct StataHeader {
     uint8_t format_version;
     bool is_big_endian;
     uint8_t filetype;
-    uint16_t nvar;
+    uint32_t nvar;
     uint64_t nobs;
     std::string data_label;
     std::string timestamp;
+    std::vector<uint32_t> sort_order;    // 0-based variable indexes from the sortlist, outermost key first
 };
 
 class StataParser {
@@ -43,6 +65,7 @@ public:
     virtual ~StataParser() = default;
     
     // File reading utilities
+    void ReadBytes(void* buffer, size_t length);
     uint8_t ReadUInt8();
     uint16_t ReadUInt16();
     uint32_t ReadUInt32(); 
@@ -60,15 +83,15 @@ public:
     template<typename T> T SwapBytes(T value);
     
     // Data type utilities
-    LogicalType StataTypeToLogicalType(const StataVariable& var);
-    bool IsStringType(StataDataType type);
+    static LogicalType StataTypeToLogicalType(const StataVariable& var);
+    static bool IsStringType(StataDataType type);
     bool IsNumericType(StataDataType type);
     
     // Missing value detection
     bool IsMissingValue(const StataVariable& var, const void* data);
     
 protected:
-    unique_ptr<std::ifstream> file_stream_;
+    unique_ptr<StataInputStream> input_;
     bool is_big_endian_;
     bool native_is_big_endian_;
     
@@ -93,11 +116,48 @@ public:
     bool Open();
     void Close();
     unique_ptr<DataChunk> ReadChunk(idx_t chunk_size = STANDARD_VECTOR_SIZE);
+    void ReadDataChunk(DataChunk& chunk, idx_t chunk_size);
+    // Decodes count rows starting at first_row into chunk. With skip, projected
+    // columns i with skip[i] set are left untouched, and the data section is not
+    // read at all if that leaves no variable to decode.
+    void ReadRows(idx_t first_row, idx_t count, DataChunk& chunk, const std::vector<bool>* skip = nullptr);
+    // Decodes the given rows, in ascending order, into chunk; skip as for ReadRows
+    void ReadSelectedRows(const idx_t* rows, idx_t count, DataChunk& chunk, const std::vector<bool>* skip = nullptr);
+    // After ReadRows or ReadSelectedRows with skip, decodes the skipped columns of
+    // the rows listed in sel (ascending, nullptr for all) into the first count
+    // rows of chunk. first_row and rows are those of the earlier call. Used to
+    // decode variables only projected for the rows that passed the filters.
+    void DecodeSkipped(idx_t first_row, const idx_t* rows, const SelectionVector* sel, idx_t count,
+                       DataChunk& chunk, const std::vector<bool>& skip);
+    // Variables decoded by ReadRows, ReadSelectedRows and ReadDataChunk, in chunk
+    // column order. COLUMN_IDENTIFIER_ROW_ID yields row numbers; other ids past
+    // the last variable yield NULL. Without any variable, rows are only counted.
+    void SetProjection(std::vector<idx_t> columns);
+    // Where a forward-only input with strLs is spilled, and the most it may take
+    // there. Must be set before the first strL is read.
+    void SetSpillOptions(StataSpillOptions options) { spill_options_ = std::move(options); }
+    // Decodes a single cell, e.g. to binary search a sorted file
+    Value ReadValue(idx_t row, idx_t column);
+    // Independent reader over the same file for parallel scans. Returns nullptr
+    // when the source can only be read front to back (e.g. plain gzip or zstd).
+    unique_ptr<StataReader> OpenCursor() const;
     
     // Metadata access
     const StataHeader& GetHeader() const { return header_; }
+    // Names and types are always available; formats and labels only after LoadMetadata
     const std::vector<StataVariable>& GetVariables() const { return variables_; }
+    // Parses formats, value label names and variable labels if Open skipped them
+    void LoadMetadata();
+    // Value label tables by name. They are stored after the data, so on
+    // forward-only inputs this must be called before reading any rows, unless
+    // strL variables are projected: spilling the rows for those reads the
+    // value labels on the way.
+    const std::map<std::string, std::map<int32_t, std::string>>& LoadValueLabels();
+    // Characteristics in file order. Never reads the data section.
+    const std::vector<StataCharacteristic>& LoadCharacteristics();
     bool HasMoreData() const { return rows_read_ < header_.nobs; }
+    uint64_t GetRowSize() const { return row_size_; }
+    StataCompression GetCompression() const { return input_ ? input_->GetCompression() : StataCompression::NONE; }
     
 private:
     std::string filename_;
@@ -105,14 +165,41 @@ private:
     std::vector<StataVariable> variables_;
     vector<LogicalType> column_types_;
     std::map<std::string, std::map<int32_t, std::string>> value_labels_;
+
+    // strLs keyed by their (v,o) reference, shared with cursors
+    shared_ptr<const std::unordered_map<uint64_t, StataStrLEntry>> strls_;
+    // Copy of the data and strL sections of a forward-only input, see LoadStrls
+    shared_ptr<StataTemporaryFile> spill_file_;
+    StataSpillOptions spill_options_;
     
+    // Section offsets from the <map> of 117+ files
+    std::vector<uint64_t> section_map_;
     uint64_t data_location_;
     uint64_t rows_read_;
+    // Start of <formats>, the first section Open may skip
+    uint64_t metadata_location_ = 0;
+    bool metadata_loaded_ = false;
+    // End of the data, where value labels start in formats before 117
+    uint64_t value_labels_location_ = 0;
+    bool value_labels_loaded_ = false;
+    std::vector<StataCharacteristic> characteristics_;
+    bool characteristics_loaded_ = false;
+    
+    // Fixed-width row layout of the data section
+    std::vector<uint64_t> column_offsets_;
+    uint64_t row_size_;
+    std::vector<uint8_t> row_buffer_;
+    std::vector<idx_t> projection_;
+    bool reads_rows_ = true;
+    // Whether the last ReadRows or ReadSelectedRows left its rows in row_buffer_
+    bool rows_buffered_ = false;
+    bool projects_strl_ = false;
     
     // Header reading
     void ReadHeader();
     void ReadOldHeader(uint8_t first_char);
     void ReadNewHeader();
+    void ReadMap();
     
     // Variable info reading
     void ReadVariableTypes();
@@ -121,16 +208,37 @@ private:
     void ReadFormats();
     void ReadValueLabelNames();
     void ReadVariableLabels();
-    void ReadCharacteristics();
+    void ReadCharacteristics(std::vector<StataCharacteristic>* characteristics);
+    void ReadCharacteristic(uint32_t length, std::vector<StataCharacteristic>* characteristics);
+    void ReadMetadata();
+    // Parses <value_labels> of 117+ files from the current position
     void ReadValueLabels();
+    void ReadValueLabelTable();
+    void SkipMetadata();
+    size_t FormatWidth() const;
+    size_t NameWidth() const;
+    size_t VariableLabelWidth() const;
     
     // Data reading
     void PrepareDataReading();
-    void ReadDataChunk(DataChunk& chunk, idx_t chunk_size);
-    void ConvertStataValue(const StataVariable& var, const uint8_t* src_data, Vector& dest_vector, idx_t row_idx);
+    bool HasStrLColumns(const std::vector<idx_t>& columns) const;
+    void LoadStrls();
+    void ReadStrls(std::unordered_map<uint64_t, StataStrLEntry>& strls);
+    // Contents of a strL, read from the input if they were not kept in memory
+    std::string FetchStrL(const StataStrLEntry& strl);
+    uint64_t DecodeStrLReference(const uint8_t* src, bool swap) const;
+    // Whether decoding the projection, less the columns in skip, needs the rows
+    bool ReadsRows(const std::vector<bool>* skip) const;
+    // Reads the given rows, in ascending order, into row_buffer_
+    void BufferSelectedRows(const idx_t* rows, idx_t count);
+    // Decodes the projected variables of the rows in row_buffer_; rows holds their
+    // row numbers, or nullptr if they start at first_row
+    void DecodeProjection(idx_t first_row, const idx_t* rows, idx_t count, DataChunk& chunk,
+                          const std::vector<bool>* skip = nullptr);
+    void DecodeColumn(const StataVariable& var, const uint8_t* rows, idx_t row_count,
+                      uint64_t column_offset, Vector& dest_vector);
     
     // Utility functions
-    std::string DecodeString(const uint8_t* data, size_t length);
     void SkipBytes(size_t count);
     uint64_t GetFilePosition();
     void SeekTo(uint64_t position);
@@ -139,9 +247,11 @@ private:
     uint64_t ReadObsCount();
     std::string ReadDataLabel();
     std::string ReadTimestamp();
+    std::vector<std::string> ReadFixedWidthStrings(size_t width);
     
     // XML format helpers (version 117+)
-    std::string FindXMLSection(const std::string& section_name);
+    bool IsXMLFormat() const { return header_.format_version >= 117; }
+    void ExpectTag(const std::string& tag);
 };
 
-} // namespace duckdb
\ No newline at end of file
+} // namespace duckdb
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "duckdb.hpp"
+#include "stata_parser.hpp"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace duckdb {
+
+// Header and variable metadata of a Stata file: everything before the data
+// section that binding a scan or listing variables needs
+struct StataSchema {
+    StataHeader header;
+    std::vector<StataVariable> variables;
+};
+
+// Schemas of Stata files kept in one cache file, so that binding scans and
+// listing headers or variables of many files costs a stat() per file instead
+// of opening and parsing each. Entries are keyed by absolute path and stamped
+// with the file's size and modification time; a stale entry is read again.
+//
+// Layout: "STATASCH" | uint32 version | uint64 entry count | entries, with
+// strings stored as a uint32 length and their bytes. The file is rewritten
+// through a uniquely named temporary file under a lock on <path>.lock, merging
+// entries other processes wrote meanwhile.
+class StataSchemaCache {
+public:
+    // Cache backed by the file at path, shared by all connections of the process
+    static shared_ptr<StataSchemaCache> Get(const std::string& path);
+
+    explicit StataSchemaCache(std::string path);
+
+    // Schema of data_path, read from the file and recorded if the cache has no
+    // current entry. nullptr if data_path is not a regular file.
+    shared_ptr<const StataSchema> Lookup(const std::string& data_path);
+    // Writes the entries recorded since the last flush, if any. Keeps them for
+    // the next flush if another process is writing the cache.
+    void Flush();
+
+private:
+    struct Entry {
+        uint64_t size;
+        int64_t mtime;
+        shared_ptr<const StataSchema> schema;
+    };
+
+    std::string path_;
+    mutex lock_;
+    std::unordered_map<std::string, Entry> entries_;
+    // Entries recorded since the last flush
+    std::unordered_set<std::string> pending_;
+    // Stamp of the cache file when it was last read or written
+    bool loaded_ = false;
+    uint64_t file_size_ = 0;
+    int64_t file_mtime_ = 0;
+
+    // Reads the cache file if it changed since it was last read or written
+    void Refresh();
+    void Write();
+};
+
+} // namespace duckdb
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "duckdb.hpp"
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <memory>
+
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
+namespace duckdb {
+
+enum class StataCompression : uint8_t {
+    NONE,
+    GZIP,
+    ZSTD
+};
+
+// A point where decompression can restart from scratch: the start of an
+// independent zstd frame or gzip member
+struct StataSeekPoint {
+    uint64_t compressed_offset;
+    uint64_t uncompressed_offset;
+};
+
+// Byte source of a Stata file. The parser reads plain and compressed files
+// through this interface, so it never needs to know where the bytes come from.
+class StataInputStream {
+public:
+    virtual ~StataInputStream() = default;
+
+    // Reads up to length bytes, returns the number of bytes read (0 at end of stream)
+    virtual size_t Read(void* buffer, size_t length) = 0;
+    // Position in the (decompressed) byte stream
+    virtual uint64_t GetPosition() const = 0;
+    // Skips count bytes forward without requiring random access
+    virtual void Skip(uint64_t count);
+
+    // Random access is only available when CanSeek() is true
+    virtual bool CanSeek() const { return false; }
+    virtual void SeekTo(uint64_t position);
+
+    // Opens an independent cursor over the same source so parallel scans can
+    // read different parts of the file. Returns nullptr for sequential-only sources.
+    virtual unique_ptr<StataInputStream> Clone() const { return nullptr; }
+
+    virtual StataCompression GetCompression() const { return StataCompression::NONE; }
+};
+
+// Uncompressed file on disk, or a pipe/FIFO/character device read front to back
+class StataFileInputStream : public StataInputStream {
+public:
+    explicit StataFileInputStream(const std::string& path);
+
+    size_t Read(void* buffer, size_t length) override;
+    uint64_t GetPosition() const override { return position_; }
+    void Skip(uint64_t count) override;
+    bool CanSeek() const override { return seekable_; }
+    void SeekTo(uint64_t position) override;
+    unique_ptr<StataInputStream> Clone() const override;
+
+    // Pushes bytes back so they are returned by the next Read; lets the magic
+    // bytes be inspected without seeking, which pipes cannot do
+    void Unread(const uint8_t* data, size_t length);
+
+private:
+    std::string path_;
+    std::ifstream file_;
+    bool seekable_;
+    uint64_t position_;
+    std::string pushback_;
+};
+
+// Shared logic of the gzip and zstd streams: buffered reads of the compressed
+// file and restarts at seek points. Without seek points the stream is forward-only.
+class StataCompressedInputStream : public StataInputStream {
+public:
+    StataCompressedInputStream(const std::string& path, unique_ptr<StataInputStream> source,
+                               shared_ptr<const std::vector<StataSeekPoint>> seek_points);
+
+    size_t Read(void* buffer, size_t length) override;
+    uint64_t GetPosition() const override { return position_; }
+    bool CanSeek() const override { return seek_points_ && !seek_points_->empty(); }
+    void SeekTo(uint64_t position) override;
+
+protected:
+    // Restarts the decoder at the start of an independent frame or member
+    virtual void ResetDecoder() = 0;
+    // Decompresses from in into out, returns the number of bytes written to out.
+    // Sets consumed to the number of input bytes used.
+    virtual size_t Decompress(const uint8_t* in, size_t in_size, size_t& consumed,
+                              uint8_t* out, size_t out_size) = 0;
+
+    std::string path_;
+    shared_ptr<const std::vector<StataSeekPoint>> seek_points_;
+
+private:
+    unique_ptr<StataInputStream> source_;
+    std::vector<uint8_t> in_buffer_;
+    size_t in_pos_;
+    size_t in_size_;
+    bool file_eof_;
+    uint64_t position_;
+
+    void RestartAt(const StataSeekPoint& point);
+};
+
+class StataGzipInputStream : public StataCompressedInputStream {
+public:
+    StataGzipInputStream(const std::string& path, unique_ptr<StataInputStream> source,
+                         shared_ptr<const std::vector<StataSeekPoint>> seek_points);
+    ~StataGzipInputStream() override;
+
+    unique_ptr<StataInputStream> Clone() const override;
+    StataCompression GetCompression() const override { return StataCompression::GZIP; }
+
+    // Reads a bgzip-style .gzi index of member boundaries, nullptr if there is none
+    static shared_ptr<const std::vector<StataSeekPoint>> ReadIndex(const std::string& path);
+
+protected:
+    void ResetDecoder() override;
+    size_t Decompress(const uint8_t* in, size_t in_size, size_t& consumed,
+                      uint8_t* out, size_t out_size) override;
+
+private:
+    unique_ptr<z_stream_s> zstream_;
+};
+
+class StataZstdInputStream : public StataCompressedInputStream {
+public:
+    StataZstdInputStream(const std::string& path, unique_ptr<StataInputStream> source,
+                         shared_ptr<const std::vector<StataSeekPoint>> seek_points);
+    ~StataZstdInputStream() override;
+
+    unique_ptr<StataInputStream> Clone() const override;
+    StataCompression GetCompression() const override { return StataCompression::ZSTD; }
+
+    // Reads the seek table of a zstd seekable-format file, nullptr if there is none
+    static shared_ptr<const std::vector<StataSeekPoint>> ReadSeekTable(const std::string& path);
+
+protected:
+    void ResetDecoder() override;
+    size_t Decompress(const uint8_t* in, size_t in_size, size_t& consumed,
+                      uint8_t* out, size_t out_size) override;
+
+private:
+    ZSTD_DCtx_s* dctx_;
+};
+
+// Temporary file that is removed when the last reference goes away. Used to spill
+// the data section of forward-only inputs whose rows need sections stored after them.
+// Created exclusively under a unique name in directory, or the system temporary
+// directory if it is empty.
+class StataTemporaryFile {
+public:
+    explicit StataTemporaryFile(const std::string& directory = std::string());
+    ~StataTemporaryFile();
+
+    const std::string& GetPath() const { return path_; }
+
+private:
+    std::string path_;
+};
+
+// Where a reader may spill a forward-only input, and how many bytes one file may
+// write there. An empty directory means spilling is disabled.
+struct StataSpillOptions {
+    std::string directory;
+    uint64_t max_bytes = std::numeric_limits<uint64_t>::max();
+};
+
+// Whether path is a regular file, as opposed to a pipe, FIFO or device like /dev/stdin
+bool StataIsRegularFile(const std::string& path);
+// Size and modification time of a regular file, to tell when derived data is stale.
+// Returns false if path is not a regular file.
+bool StataFileStamp(const std::string& path, uint64_t& size, int64_t& mtime);
+
+// Absolute, normalized form of path, to key caches by file
+std::string StataAbsolutePath(const std::string& path);
+
+// Opens a Stata file, detecting gzip and zstd compression from the magic bytes
+unique_ptr<StataInputStream> OpenStataInputStream(const std::string& path);
+
+} // namespace duckdb
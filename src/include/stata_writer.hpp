@@ -0,0 +1,202 @@
+#pragma once
+
+#include "duckdb.hpp"
+#include "stata_parser.hpp"
+#include "stata_stream.hpp"
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace duckdb {
+
+// Output column: the DuckDB source type and the Stata storage type it starts out as
+struct StataWriterColumn {
+    std::string name;
+    LogicalType source_type;
+    StataDataType type;
+    uint16_t str_len;    // For fixed-width string types
+    std::vector<std::string> value_labels;    // ENUM dictionary; code i + 1 is labelled value_labels[i]
+};
+
+// Storage type of one variable in the data section
+struct StataColumnLayout {
+    StataDataType type;
+    uint16_t str_len;
+
+    bool operator==(const StataColumnLayout& other) const {
+        return type == other.type && str_len == other.str_len;
+    }
+    bool operator!=(const StataColumnLayout& other) const {
+        return !(*this == other);
+    }
+};
+
+// Fixed-width row layout. Types only ever widen while writing (strN to strL and
+// byte to double included), so rows encoded with an earlier layout can always be
+// converted to a later one.
+struct StataRowLayout {
+    std::vector<StataColumnLayout> columns;
+    std::vector<uint64_t> offsets;
+    uint64_t row_size = 0;
+
+    void ComputeOffsets();
+    bool operator==(const StataRowLayout& other) const {
+        return columns == other.columns;
+    }
+    bool operator!=(const StataRowLayout& other) const {
+        return !(*this == other);
+    }
+};
+
+// A strL value referenced from a row block
+struct StataStrL {
+    uint32_t v;          // 1-based variable number
+    uint64_t o;          // 1-based observation number, relative to the block until written
+    std::string contents;
+};
+
+// Rows encoded in the fixed-width layout of the data section, ready to be appended
+struct StataRowBlock {
+    idx_t count = 0;
+    StataRowLayout layout;
+    std::vector<uint8_t> rows;
+    std::vector<StataStrL> strls;
+    // Per column: strL contents already in strls and the (v,o) reference of the first occurrence
+    std::vector<std::unordered_map<std::string, uint64_t>> strl_index;
+
+    void Clear() {
+        count = 0;
+        layout = StataRowLayout();
+        rows.clear();
+        strls.clear();
+        strl_index.clear();
+    }
+};
+
+// Bytes of strL contents the writers of one COPY may keep for deduplication.
+// Shared, so PARTITION_BY does not multiply it by the number of open files.
+class StataStrLBudget {
+public:
+    explicit StataStrLBudget(idx_t limit) : limit_(limit), used_(0) {
+    }
+
+    // Takes bytes from the budget; false if that would exceed it
+    bool Reserve(idx_t bytes) {
+        idx_t used = used_.load();
+        do {
+            if (used + bytes > limit_) {
+                return false;
+            }
+        } while (!used_.compare_exchange_weak(used, used + bytes));
+        return true;
+    }
+    void Release(idx_t bytes) {
+        used_ -= bytes;
+    }
+
+private:
+    idx_t limit_;
+    std::atomic<idx_t> used_;
+};
+
+// Writes Stata 117/118/119 files in a single pass. Encoding is independent per
+// block so it can run on many threads; blocks are then appended by a single
+// writer in order.
+//
+// String widths and the row count are only known at the end. Each block is
+// encoded with the narrowest layout that fits it, and the file layout widens as
+// blocks are appended. Finish converts rows written under narrower layouts in
+// place, back to front, and patches <N>, <variable_types>, <formats> and <map>.
+// Only when a wide strN column turns into strL and rows shrink does the
+// conversion go through a temporary file.
+class StataWriter {
+public:
+    // sort_columns: variables the rows are expected to be ordered by. They are
+    // recorded in <sortlist> only if the written rows confirm the order.
+    // strl_budget: shared with the other writers of the same COPY; without one the
+    // writer keeps up to 64 MiB of strL contents for deduplication.
+    StataWriter(const std::string& filename, std::vector<StataWriterColumn> columns, uint16_t format_version,
+                bool compress, std::vector<idx_t> sort_columns, shared_ptr<StataStrLBudget> strl_budget = nullptr);
+    ~StataWriter();
+
+    // Maps DuckDB result columns to Stata variables; throws for unsupported types.
+    // With compress, numeric columns start out as byte and widen as values require.
+    static std::vector<StataWriterColumn> BindColumns(const vector<string>& names, const vector<LogicalType>& types,
+                                                      uint16_t format_version, bool compress);
+
+    // Encodes chunk and appends it to block. Does not touch the file, safe to call concurrently.
+    void EncodeChunk(DataChunk& chunk, StataRowBlock& block) const;
+    // Appends an encoded block to the data section. Calls must be serialized.
+    void WriteBlock(StataRowBlock& block);
+    // Writes the sections after the data and patches the header and map
+    void Finish();
+
+private:
+    // Rows of the data section that were written with the same layout
+    struct DataSegment {
+        uint64_t first_row;
+        uint64_t file_offset;
+        StataRowLayout layout;
+    };
+
+    std::string filename_;
+    std::vector<StataWriterColumn> columns_;
+    uint16_t format_version_;
+    bool compress_;
+    bool is_big_endian_;
+
+    std::fstream file_;
+    uint64_t rows_written_;
+    uint64_t nobs_position_;
+    uint64_t data_location_;
+    std::vector<uint64_t> section_map_;
+    StataRowLayout layout_;
+    std::vector<DataSegment> segments_;
+    // strL payloads are streamed here and copied after the data section in Finish
+    unique_ptr<StataTemporaryFile> strls_file_;
+    std::ofstream strls_stream_;
+    // Per column: strL contents already written and their absolute (v,o) reference.
+    // Bounded by strl_budget_; strl_index_bytes_ is this writer's share of it.
+    std::vector<std::unordered_map<std::string, uint64_t>> strl_index_;
+    shared_ptr<StataStrLBudget> strl_budget_;
+    idx_t strl_index_bytes_;
+    // Expected sort order and the key of the last row written, to verify it
+    std::vector<idx_t> sort_columns_;
+    bool sort_holds_;
+    bool has_last_key_;
+    std::vector<double> last_numbers_;
+    std::vector<std::string> last_strings_;
+
+    StataRowLayout InitialLayout() const;
+    static StataRowLayout WidenLayout(const StataRowLayout& a, const StataRowLayout& b);
+    void ConvertRows(const uint8_t* src, const StataRowLayout& from, uint8_t* dst, const StataRowLayout& to,
+                     idx_t count, uint64_t first_o, std::vector<StataStrL>& strls) const;
+    void ReadSegmentRows(const DataSegment& segment, uint64_t first, idx_t count, std::vector<uint8_t>& target);
+    void RelayoutData();
+    void CheckSortOrder(const StataRowBlock& block);
+
+    void WriteHeader();
+    void WriteTag(const std::string& tag);
+    void WriteBytes(const void* data, size_t length);
+    void WriteFixedWidthString(const std::string& value, size_t width);
+    template <class T> void WriteValue(T value);
+    void WriteObsCount(uint64_t nobs);
+    void WriteVariableTypes();
+    void WriteFormats();
+    void WriteValueLabels();
+    void WriteSortList();
+    void DeduplicateStrLs(std::vector<StataStrL>& strls, uint64_t o_offset, uint8_t* rows, const StataRowLayout& layout,
+                          idx_t count);
+    void ReleaseStrLIndex();
+    void WriteStrLs(const std::vector<StataStrL>& strls, uint64_t o_offset);
+    uint64_t GetPosition();
+
+    size_t GetStrLVariableBytes() const;
+    uint64_t MakeStrLReference(uint64_t v, uint64_t o) const;
+    void EncodeColumn(const StataWriterColumn& column, idx_t col_idx, Vector& source, idx_t count, uint8_t* dest,
+                      StataRowBlock& block) const;
+};
+
+} // namespace duckdb
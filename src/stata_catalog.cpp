@@ -0,0 +1,405 @@
+#include "stata_catalog.hpp"
+#include "stata_dta_extension.hpp"
+#include "stata_stream.hpp"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/common/local_file_system.hpp"
+#include "duckdb/common/string_util.hpp"
+#include "duckdb/main/attached_database.hpp"
+#include "duckdb/parser/parsed_data/attach_info.hpp"
+#include "duckdb/parser/parsed_data/create_schema_info.hpp"
+#include "duckdb/parser/parsed_data/create_table_info.hpp"
+#include "duckdb/storage/database_size.hpp"
+#include <algorithm>
+
+namespace duckdb {
+
+// File extensions of attached tables, tried in this order when a name is looked up
+static const char *const STATA_TABLE_EXTENSIONS[] = {".dta", ".dta.gz", ".dta.zst"};
+
+static void StataThrowReadOnly() {
+	throw PermissionException("Stata catalogs are read-only");
+}
+
+//===--------------------------------------------------------------------===//
+// Storage extension
+//===--------------------------------------------------------------------===//
+static unique_ptr<Catalog> StataAttach(optional_ptr<StorageExtensionInfo> storage_info, ClientContext &context,
+                                       AttachedDatabase &db, const string &name, AttachInfo &info,
+                                       AttachOptions &options) {
+	LocalFileSystem fs;
+	if (!fs.DirectoryExists(info.path)) {
+		throw IOException("Cannot attach Stata directory \"%s\": not a directory", info.path);
+	}
+	return make_uniq<StataCatalog>(db, info.path);
+}
+
+static unique_ptr<TransactionManager> StataCreateTransactionManager(optional_ptr<StorageExtensionInfo> storage_info,
+                                                                    AttachedDatabase &db, Catalog &catalog) {
+	return make_uniq<StataTransactionManager>(db);
+}
+
+StataStorageExtension::StataStorageExtension() {
+	attach = StataAttach;
+	create_transaction_manager = StataCreateTransactionManager;
+}
+
+//===--------------------------------------------------------------------===//
+// Tables
+//===--------------------------------------------------------------------===//
+StataTableEntry::StataTableEntry(Catalog &catalog, SchemaCatalogEntry &schema, CreateTableInfo &info,
+                                 std::string filename, uint64_t nobs)
+    : TableCatalogEntry(catalog, schema, info), filename_(std::move(filename)), nobs_(nobs) {
+}
+
+// Scans report statistics through read_stata_dta, see StataDtaStatistics
+unique_ptr<BaseStatistics> StataTableEntry::GetStatistics(ClientContext &context, column_t column_id) {
+	return nullptr;
+}
+
+TableFunction StataTableEntry::GetScanFunction(ClientContext &context, unique_ptr<FunctionData> &bind_data) {
+	vector<LogicalType> types;
+	vector<string> names;
+	bind_data = StataBindFile(context, filename_, types, names);
+	StataRegisterScan(context, *bind_data);
+	return GetStataReadFunction();
+}
+
+TableStorageInfo StataTableEntry::GetStorageInfo(ClientContext &context) {
+	TableStorageInfo result;
+	result.cardinality = nobs_;
+	return result;
+}
+
+//===--------------------------------------------------------------------===//
+// Schema
+//===--------------------------------------------------------------------===//
+StataSchemaEntry::StataSchemaEntry(Catalog &catalog, CreateSchemaInfo &info, std::string directory)
+    : SchemaCatalogEntry(catalog, info), directory_(std::move(directory)) {
+}
+
+// Table name for a file in the directory, or "" if it is not a Stata file
+static std::string StataTableName(const std::string &file) {
+	auto lower = StringUtil::Lower(file);
+	for (auto extension : STATA_TABLE_EXTENSIONS) {
+		if (StringUtil::EndsWith(lower, extension) && file.size() > strlen(extension)) {
+			return file.substr(0, file.size() - strlen(extension));
+		}
+	}
+	return "";
+}
+
+case_insensitive_map_t<std::string> StataSchemaEntry::ListFiles() const {
+	LocalFileSystem fs;
+	case_insensitive_map_t<std::string> files;
+	fs.ListFiles(directory_, [&](const string &file, bool is_directory) {
+		if (is_directory) {
+			return;
+		}
+		auto name = StataTableName(file);
+		if (!name.empty() && files.find(name) == files.end()) {
+			files[name] = fs.JoinPath(directory_, file);
+		}
+	});
+	return files;
+}
+
+std::string StataSchemaEntry::FindFile(const std::string &name) const {
+	// The exact name first, so a lookup does not have to list the directory
+	LocalFileSystem fs;
+	uint64_t size;
+	int64_t mtime;
+	for (auto extension : STATA_TABLE_EXTENSIONS) {
+		auto path = fs.JoinPath(directory_, name + extension);
+		if (StataFileStamp(path, size, mtime)) {
+			return path;
+		}
+	}
+	// Table names are case-insensitive, file names may not be
+	auto files = ListFiles();
+	auto entry = files.find(name);
+	return entry == files.end() ? "" : entry->second;
+}
+
+optional_ptr<StataTableEntry> StataSchemaEntry::GetTable(optional_ptr<ClientContext> context, const std::string &name,
+                                                        const std::string &filename) {
+	uint64_t size;
+	int64_t mtime;
+	if (!StataFileStamp(filename, size, mtime)) {
+		return nullptr;
+	}
+	auto is_current = [&](const CachedTable &cached) {
+		return cached.entry->GetFilename() == filename && cached.size == size && cached.mtime == mtime;
+	};
+	{
+		lock_guard<mutex> guard(lock_);
+		auto cached = tables_.find(name);
+		if (cached != tables_.end() && is_current(cached->second)) {
+			return cached->second.entry.get();
+		}
+	}
+
+	// The header is read without the lock, so lookups of other tables do not wait on it
+	vector<LogicalType> types;
+	vector<string> names;
+	auto bind_data = StataBindFile(context, filename, types, names);
+	CreateTableInfo info(*this, name);
+	for (idx_t i = 0; i < types.size(); i++) {
+		info.columns.AddColumn(ColumnDefinition(names[i], types[i]));
+	}
+	auto entry = make_uniq<StataTableEntry>(catalog, *this, info, filename, StataBoundRowCount(*bind_data));
+
+	lock_guard<mutex> guard(lock_);
+	ReleaseRetired();
+	auto cached = tables_.find(name);
+	if (cached != tables_.end()) {
+		if (is_current(cached->second)) {
+			// Another lookup read the same file meanwhile
+			return cached->second.entry.get();
+		}
+		// The file was rewritten; queries that already bound the old entry keep it
+		auto &transactions = catalog.GetAttached().GetTransactionManager().Cast<StataTransactionManager>();
+		retired_.push_back(RetiredTable {transactions.NextStart(), std::move(cached->second.entry)});
+		tables_.erase(cached);
+	}
+	auto result = entry.get();
+	tables_[name] = CachedTable {size, mtime, std::move(entry)};
+	return result;
+}
+
+void StataSchemaEntry::ReleaseRetired() {
+	if (retired_.empty()) {
+		return;
+	}
+	auto oldest = catalog.GetAttached().GetTransactionManager().Cast<StataTransactionManager>().OldestStart();
+	retired_.erase(std::remove_if(retired_.begin(), retired_.end(),
+	                              [&](const RetiredTable &retired) { return retired.retired_at <= oldest; }),
+	               retired_.end());
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::LookupEntry(CatalogTransaction transaction,
+                                                         const EntryLookupInfo &lookup_info) {
+	if (lookup_info.GetCatalogType() != CatalogType::TABLE_ENTRY) {
+		return nullptr;
+	}
+	auto &name = lookup_info.GetEntryName();
+	auto filename = FindFile(name);
+	if (filename.empty()) {
+		return nullptr;
+	}
+	return GetTable(transaction.context, name, filename);
+}
+
+void StataSchemaEntry::Scan(ClientContext &context, CatalogType type,
+                            const std::function<void(CatalogEntry &)> &callback) {
+	if (type != CatalogType::TABLE_ENTRY) {
+		return;
+	}
+	for (auto &file : ListFiles()) {
+		auto table = GetTable(context, file.first, file.second);
+		if (table) {
+			callback(*table);
+		}
+	}
+}
+
+void StataSchemaEntry::Scan(CatalogType type, const std::function<void(CatalogEntry &)> &callback) {
+	if (type != CatalogType::TABLE_ENTRY) {
+		return;
+	}
+	for (auto &file : ListFiles()) {
+		auto table = GetTable(nullptr, file.first, file.second);
+		if (table) {
+			callback(*table);
+		}
+	}
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateIndex(CatalogTransaction transaction, CreateIndexInfo &info,
+                                                         TableCatalogEntry &table) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateFunction(CatalogTransaction transaction, CreateFunctionInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateTable(CatalogTransaction transaction, BoundCreateTableInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateView(CatalogTransaction transaction, CreateViewInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateSequence(CatalogTransaction transaction, CreateSequenceInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateTableFunction(CatalogTransaction transaction,
+                                                                 CreateTableFunctionInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateCopyFunction(CatalogTransaction transaction,
+                                                                CreateCopyFunctionInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreatePragmaFunction(CatalogTransaction transaction,
+                                                                  CreatePragmaFunctionInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateCollation(CatalogTransaction transaction,
+                                                             CreateCollationInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+optional_ptr<CatalogEntry> StataSchemaEntry::CreateType(CatalogTransaction transaction, CreateTypeInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+void StataSchemaEntry::DropEntry(ClientContext &context, DropInfo &info) {
+	StataThrowReadOnly();
+}
+
+void StataSchemaEntry::Alter(CatalogTransaction transaction, AlterInfo &info) {
+	StataThrowReadOnly();
+}
+
+//===--------------------------------------------------------------------===//
+// Catalog
+//===--------------------------------------------------------------------===//
+StataCatalog::StataCatalog(AttachedDatabase &db, std::string directory)
+    : Catalog(db), directory_(std::move(directory)) {
+}
+
+void StataCatalog::Initialize(bool load_builtin) {
+	CreateSchemaInfo info;
+	info.schema = DEFAULT_SCHEMA;
+	main_schema_ = make_uniq<StataSchemaEntry>(*this, info, directory_);
+}
+
+optional_ptr<CatalogEntry> StataCatalog::CreateSchema(CatalogTransaction transaction, CreateSchemaInfo &info) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+void StataCatalog::ScanSchemas(ClientContext &context, std::function<void(SchemaCatalogEntry &)> callback) {
+	callback(*main_schema_);
+}
+
+optional_ptr<SchemaCatalogEntry> StataCatalog::LookupSchema(CatalogTransaction transaction,
+                                                            const EntryLookupInfo &schema_lookup,
+                                                            OnEntryNotFound if_not_found) {
+	auto &name = schema_lookup.GetEntryName();
+	if (name == DEFAULT_SCHEMA || name == INVALID_SCHEMA) {
+		return main_schema_.get();
+	}
+	if (if_not_found == OnEntryNotFound::RETURN_NULL) {
+		return nullptr;
+	}
+	throw BinderException("Stata catalog \"%s\" only has the schema \"%s\"", GetName(), DEFAULT_SCHEMA);
+}
+
+PhysicalOperator &StataCatalog::PlanCreateTableAs(ClientContext &context, PhysicalPlanGenerator &planner,
+                                                  LogicalCreateTable &op, PhysicalOperator &plan) {
+	StataThrowReadOnly();
+	return plan;
+}
+
+PhysicalOperator &StataCatalog::PlanInsert(ClientContext &context, PhysicalPlanGenerator &planner, LogicalInsert &op,
+                                           optional_ptr<PhysicalOperator> plan) {
+	StataThrowReadOnly();
+	return *plan;
+}
+
+PhysicalOperator &StataCatalog::PlanDelete(ClientContext &context, PhysicalPlanGenerator &planner, LogicalDelete &op,
+                                           PhysicalOperator &plan) {
+	StataThrowReadOnly();
+	return plan;
+}
+
+PhysicalOperator &StataCatalog::PlanUpdate(ClientContext &context, PhysicalPlanGenerator &planner, LogicalUpdate &op,
+                                           PhysicalOperator &plan) {
+	StataThrowReadOnly();
+	return plan;
+}
+
+unique_ptr<LogicalOperator> StataCatalog::BindCreateIndex(Binder &binder, CreateStatement &stmt,
+                                                          TableCatalogEntry &table, unique_ptr<LogicalOperator> plan) {
+	StataThrowReadOnly();
+	return nullptr;
+}
+
+DatabaseSize StataCatalog::GetDatabaseSize(ClientContext &context) {
+	DatabaseSize result;
+	result.total_blocks = 0;
+	result.block_size = 0;
+	result.free_blocks = 0;
+	result.used_blocks = 0;
+	result.wal_size = 0;
+	result.bytes = 0;
+	uint64_t size;
+	int64_t mtime;
+	LocalFileSystem fs;
+	fs.ListFiles(directory_, [&](const string &file, bool is_directory) {
+		if (!is_directory && !StataTableName(file).empty() &&
+		    StataFileStamp(fs.JoinPath(directory_, file), size, mtime)) {
+			result.bytes += size;
+		}
+	});
+	return result;
+}
+
+void StataCatalog::DropSchema(ClientContext &context, DropInfo &info) {
+	StataThrowReadOnly();
+}
+
+//===--------------------------------------------------------------------===//
+// Transactions
+//===--------------------------------------------------------------------===//
+Transaction &StataTransactionManager::StartTransaction(ClientContext &context) {
+	lock_guard<mutex> guard(lock_);
+	auto transaction = make_uniq<StataTransaction>(*this, context, next_start_++);
+	auto &result = *transaction;
+	transactions_[result] = std::move(transaction);
+	return result;
+}
+
+transaction_t StataTransactionManager::NextStart() {
+	lock_guard<mutex> guard(lock_);
+	return next_start_;
+}
+
+transaction_t StataTransactionManager::OldestStart() {
+	lock_guard<mutex> guard(lock_);
+	auto oldest = next_start_;
+	for (auto &transaction : transactions_) {
+		oldest = MinValue(oldest, transaction.second->start);
+	}
+	return oldest;
+}
+
+ErrorData StataTransactionManager::CommitTransaction(ClientContext &context, Transaction &transaction) {
+	lock_guard<mutex> guard(lock_);
+	transactions_.erase(transaction);
+	return ErrorData();
+}
+
+void StataTransactionManager::RollbackTransaction(Transaction &transaction) {
+	lock_guard<mutex> guard(lock_);
+	transactions_.erase(transaction);
+}
+
+} // namespace duckdb
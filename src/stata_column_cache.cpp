@@ -0,0 +1,392 @@
+#include "stata_column_cache.hpp"
+#include "stata_stream.hpp"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/main/client_context.hpp"
+#include "duckdb/main/config.hpp"
+#include "duckdb/storage/buffer_manager.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace duckdb {
+
+StataColumnCache::StataColumnCache(Allocator& allocator) : allocator_(allocator) {
+}
+
+shared_ptr<StataColumnCache> StataColumnCache::Get(ClientContext& context) {
+    Value setting;
+    idx_t capacity = 0;
+    if (context.TryGetCurrentSetting("stata_column_cache_size", setting) && !setting.IsNull()) {
+        capacity = DBConfig::ParseMemoryLimit(StringValue::Get(setting));
+    }
+    auto& object_cache = ObjectCache::GetObjectCache(context);
+    if (capacity == 0 || capacity == DConstants::INVALID_INDEX) {
+        // Release what an earlier setting cached
+        auto cache = object_cache.Get<StataColumnCache>(ObjectType());
+        if (cache) {
+            cache->SetCapacity(0);
+        }
+        return nullptr;
+    }
+    auto cache = object_cache.GetOrCreate<StataColumnCache>(ObjectType(), BufferAllocator::Get(context));
+    cache->SetCapacity(capacity);
+    return cache;
+}
+
+std::string StataColumnCache::Fingerprint(const std::string& path) {
+    uint64_t size;
+    int64_t mtime;
+    if (!StataFileStamp(path, size, mtime)) {
+        return std::string();
+    }
+    return StataAbsolutePath(path) + "|" + std::to_string(size) + "|" + std::to_string(mtime);
+}
+
+static std::string StataColumnCacheKey(const std::string& fingerprint, idx_t column, idx_t first_row) {
+    return fingerprint + "|" + std::to_string(column) + "|" + std::to_string(first_row);
+}
+
+idx_t StataCachedValues::EncodedSize(Vector& source, idx_t count) {
+    auto& type = source.GetType();
+    if (type.InternalType() != PhysicalType::VARCHAR) {
+        return count + count * GetTypeIdSize(type.InternalType());
+    }
+    UnifiedVectorFormat format;
+    source.ToUnifiedFormat(count, format);
+    auto strings = UnifiedVectorFormat::GetData<string_t>(format);
+    idx_t size = count + count * sizeof(uint32_t);
+    for (idx_t row = 0; row < count; row++) {
+        auto idx = format.sel->get_index(row);
+        if (format.validity.RowIsValid(idx)) {
+            size += strings[idx].GetSize();
+        }
+    }
+    return size;
+}
+
+bool StataCachedValues::Encode(Allocator& allocator, Vector& source, idx_t count, idx_t size) {
+    type = source.GetType();
+    rows = count;
+    bytes = size;
+    try {
+        data = allocator.Allocate(size);
+    } catch (OutOfMemoryException&) {
+        // Cached values give way to queries when memory is short
+        return false;
+    }
+    UnifiedVectorFormat format;
+    source.ToUnifiedFormat(count, format);
+    bool is_string = type.InternalType() == PhysicalType::VARCHAR;
+    idx_t width = is_string ? sizeof(uint32_t) : GetTypeIdSize(type.InternalType());
+    auto validity = data.get();
+    auto values = validity + count;
+    auto strings = values + count * width;
+    for (idx_t row = 0; row < count; row++) {
+        auto idx = format.sel->get_index(row);
+        bool valid = format.validity.RowIsValid(idx);
+        validity[row] = valid ? 1 : 0;
+        if (is_string) {
+            uint32_t length = 0;
+            if (valid) {
+                auto& value = UnifiedVectorFormat::GetData<string_t>(format)[idx];
+                length = static_cast<uint32_t>(value.GetSize());
+                std::memcpy(strings, value.GetData(), length);
+                strings += length;
+            }
+            std::memcpy(values + row * width, &length, sizeof(length));
+        } else {
+            std::memcpy(values + row * width, format.data + idx * width, width);
+        }
+    }
+    return true;
+}
+
+bool StataCachedValues::Decode(idx_t count, Vector& result) const {
+    if (rows < count || type != result.GetType()) {
+        return false;
+    }
+    auto validity = data.get();
+    auto values = validity + rows;
+    result.SetVectorType(VectorType::FLAT_VECTOR);
+    auto& mask = FlatVector::Validity(result);
+    for (idx_t row = 0; row < count; row++) {
+        if (!validity[row]) {
+            mask.SetInvalid(row);
+        }
+    }
+    if (type.InternalType() == PhysicalType::VARCHAR) {
+        auto lengths = reinterpret_cast<const uint32_t*>(values);
+        auto strings = reinterpret_cast<const char*>(values + rows * sizeof(uint32_t));
+        auto result_data = FlatVector::GetData<string_t>(result);
+        for (idx_t row = 0; row < count; row++) {
+            if (validity[row]) {
+                result_data[row] = StringVector::AddString(result, strings, lengths[row]);
+            }
+            strings += lengths[row];
+        }
+    } else {
+        std::memcpy(FlatVector::GetData(result), values, count * GetTypeIdSize(type.InternalType()));
+    }
+    return true;
+}
+
+bool StataColumnCache::Fetch(const std::string& fingerprint, idx_t column, idx_t first_row, idx_t count,
+                             Vector& result) {
+    shared_ptr<Entry> entry;
+    {
+        lock_guard<mutex> guard(lock_);
+        auto found = entries_.find(StataColumnCacheKey(fingerprint, column, first_row));
+        if (found == entries_.end()) {
+            return false;
+        }
+        entry = found->second->second;
+        lru_.splice(lru_.begin(), lru_, found->second);
+    }
+    // Copied without the lock; the entry stays alive even if it is evicted meanwhile
+    return entry->values.Decode(count, result);
+}
+
+void StataColumnCache::Store(const std::string& fingerprint, const std::string& filename, const std::string& variable,
+                             idx_t column, idx_t first_row, idx_t count, Vector& source) {
+    auto key = StataColumnCacheKey(fingerprint, column, first_row);
+    auto size = StataCachedValues::EncodedSize(source, count);
+    {
+        lock_guard<mutex> guard(lock_);
+        if (size > capacity_ || entries_.find(key) != entries_.end()) {
+            return;
+        }
+    }
+
+    auto entry = make_shared_ptr<Entry>();
+    entry->info = EntryInfo {filename, variable, first_row, count, size};
+    if (!entry->values.Encode(allocator_, source, count, size)) {
+        return;
+    }
+
+    lock_guard<mutex> guard(lock_);
+    if (entries_.find(key) != entries_.end()) {
+        return;
+    }
+    lru_.emplace_front(key, std::move(entry));
+    entries_[key] = lru_.begin();
+    size_ += size;
+    Evict();
+}
+
+std::vector<StataColumnCache::EntryInfo> StataColumnCache::GetEntries() {
+    lock_guard<mutex> guard(lock_);
+    std::vector<EntryInfo> result;
+    for (auto& entry : lru_) {
+        result.push_back(entry.second->info);
+    }
+    return result;
+}
+
+void StataColumnCache::SetCapacity(idx_t capacity) {
+    lock_guard<mutex> guard(lock_);
+    capacity_ = capacity;
+    Evict();
+}
+
+void StataColumnCache::Evict() {
+    while (size_ > capacity_ && !lru_.empty()) {
+        auto& last = lru_.back();
+        size_ -= last.second->info.bytes;
+        entries_.erase(last.first);
+        lru_.pop_back();
+    }
+}
+
+StataSharedScans::StataSharedScans(Allocator& allocator, idx_t capacity)
+    : allocator_(allocator), capacity_(capacity) {
+}
+
+shared_ptr<StataSharedScans> StataSharedScans::Get(ClientContext& context) {
+    // At most a quarter of the memory limit, so shared row groups leave room for the query itself
+    auto capacity = BufferManager::GetBufferManager(context).GetMaxMemory() / 4;
+    return context.registered_state->GetOrCreate<StataSharedScans>("stata_shared_scans", BufferAllocator::Get(context),
+                                                                   capacity);
+}
+
+idx_t StataSharedScans::Register(const std::string& path) {
+    lock_guard<mutex> guard(lock_);
+    auto& file = files_[path];
+    file.finished.push_back(false);
+    file.projected.push_back(false);
+    file.columns.emplace_back();
+    return file.finished.size() - 1;
+}
+
+bool StataSharedScans::IsShared(const std::string& path) {
+    lock_guard<mutex> guard(lock_);
+    auto file = files_.find(path);
+    return file != files_.end() && file->second.finished.size() >= 2;
+}
+
+void StataSharedScans::SetProjection(const std::string& path, idx_t scan, const std::vector<idx_t>& columns) {
+    lock_guard<mutex> guard(lock_);
+    auto file = files_.find(path);
+    if (file == files_.end() || scan >= file->second.finished.size()) {
+        return;
+    }
+    file->second.projected[scan] = true;
+    file->second.columns[scan] = std::unordered_set<idx_t>(columns.begin(), columns.end());
+    ReleaseSlots(path, scan);
+}
+
+void StataSharedScans::Finish(const std::string& path, idx_t scan) {
+    lock_guard<mutex> guard(lock_);
+    auto file = files_.find(path);
+    if (file == files_.end() || scan >= file->second.finished.size()) {
+        return;
+    }
+    file->second.finished[scan] = true;
+    ReleaseSlots(path, scan);
+}
+
+void StataSharedScans::ReleaseSlots(const std::string& path, idx_t scan) {
+    auto& file = files_[path];
+    std::vector<std::string> released;
+    for (auto& entry : slots_) {
+        auto& slot = entry.second;
+        if (slot.path != path || slot.decoding || slot.read[scan]) {
+            continue;
+        }
+        if (file.finished[scan] || (file.projected[scan] && !file.columns[scan].count(slot.column))) {
+            released.push_back(entry.first);
+        }
+    }
+    for (auto& key : released) {
+        MarkRead(key, scan);
+    }
+}
+
+shared_ptr<StataCachedValues> StataSharedScans::MarkRead(const std::string& key, idx_t scan) {
+    auto found = slots_.find(key);
+    auto values = found->second.values;
+    auto& read = found->second.read;
+    if (scan < read.size()) {
+        read[scan] = true;
+    }
+    if (std::find(read.begin(), read.end(), false) == read.end()) {
+        size_ -= values->bytes;
+        slots_.erase(found);
+    }
+    return values;
+}
+
+StataSharedScans::FetchResult StataSharedScans::Fetch(const std::string& path, idx_t scan, idx_t column,
+                                                      idx_t first_row, idx_t count, Vector& result, bool claim) {
+    auto key = StataColumnCacheKey(path, column, first_row);
+    shared_ptr<StataCachedValues> values;
+    {
+        lock_guard<mutex> guard(lock_);
+        auto found = slots_.find(key);
+        if (found == slots_.end()) {
+            if (claim) {
+                auto& slot = slots_[key];
+                slot.path = path;
+                slot.column = column;
+            }
+            return FetchResult::DECODE;
+        }
+        if (found->second.decoding) {
+            return claim ? FetchResult::WAIT : FetchResult::DECODE;
+        }
+        values = MarkRead(key, scan);
+    }
+    // Copied without the lock; the values stay alive even if the slot is dropped meanwhile
+    return values->Decode(count, result) ? FetchResult::FOUND : FetchResult::DECODE;
+}
+
+void StataSharedScans::Store(const std::string& path, idx_t scan, idx_t column, idx_t first_row, idx_t count,
+                             Vector& source) {
+    auto key = StataColumnCacheKey(path, column, first_row);
+    auto size = StataCachedValues::EncodedSize(source, count);
+    // Scans that are done or do not read the variable will never copy it
+    std::vector<bool> read;
+    {
+        lock_guard<mutex> guard(lock_);
+        auto found = slots_.find(key);
+        if (found == slots_.end() || !found->second.decoding) {
+            // Not claimed by this scan
+            return;
+        }
+        auto& file = files_[path];
+        read.resize(file.finished.size());
+        for (idx_t other = 0; other < read.size(); other++) {
+            read[other] = other == scan || file.finished[other] ||
+                          (file.projected[other] && !file.columns[other].count(column));
+        }
+        bool wanted = std::find(read.begin(), read.end(), false) != read.end();
+        if (!wanted || size_ + size > capacity_) {
+            // Not kept; whoever waits for it decodes it itself
+            slots_.erase(found);
+            decoded_.notify_all();
+            return;
+        }
+        // Reserved now, so concurrent stores cannot overshoot the cap
+        size_ += size;
+    }
+
+    auto values = make_shared_ptr<StataCachedValues>();
+    bool encoded = values->Encode(allocator_, source, count, size);
+    lock_guard<mutex> guard(lock_);
+    auto found = slots_.find(key);
+    if (!encoded || found == slots_.end() || !found->second.decoding) {
+        size_ -= size;
+        if (found != slots_.end() && found->second.decoding) {
+            slots_.erase(found);
+        }
+    } else {
+        auto& slot = found->second;
+        slot.decoding = false;
+        slot.values = std::move(values);
+        // Scans that finished meanwhile were not waited for
+        auto& file = files_[path];
+        for (idx_t other = 0; other < read.size(); other++) {
+            read[other] = read[other] || file.finished[other];
+        }
+        slot.read = std::move(read);
+        if (std::find(slot.read.begin(), slot.read.end(), false) == slot.read.end()) {
+            size_ -= size;
+            slots_.erase(found);
+        }
+    }
+    decoded_.notify_all();
+}
+
+void StataSharedScans::Abandon(const std::string& path, idx_t column, idx_t first_row) {
+    lock_guard<mutex> guard(lock_);
+    auto found = slots_.find(StataColumnCacheKey(path, column, first_row));
+    if (found != slots_.end() && found->second.decoding) {
+        slots_.erase(found);
+    }
+    decoded_.notify_all();
+}
+
+bool StataSharedScans::Wait(const std::string& path, idx_t scan, idx_t column, idx_t first_row, idx_t count,
+                            Vector& result) {
+    auto key = StataColumnCacheKey(path, column, first_row);
+    shared_ptr<StataCachedValues> values;
+    {
+        unique_lock<mutex> guard(lock_);
+        decoded_.wait(guard, [&]() {
+            auto found = slots_.find(key);
+            return found == slots_.end() || !found->second.decoding;
+        });
+        if (slots_.find(key) == slots_.end()) {
+            return false;
+        }
+        values = MarkRead(key, scan);
+    }
+    return values->Decode(count, result);
+}
+
+void StataSharedScans::QueryEnd(ClientContext& context) {
+    lock_guard<mutex> guard(lock_);
+    files_.clear();
+    slots_.clear();
+    size_ = 0;
+}
+
+} // namespace duckdb
@@ -1,79 +1,2002 @@
 #define DUCKDB_EXTENSION_MAIN
 
 #include "stata_dta_extension.hpp"
+#include "stata_catalog.hpp"
+#include "stata_column_cache.hpp"
+#include "stata_key_index.hpp"
 #include "stata_parser.hpp"
+#include "stata_schema_cache.hpp"
+#include "stata_writer.hpp"
 #include "duckdb.hpp"
+#include "duckdb/catalog/catalog.hpp"
+#include "duckdb/catalog/catalog_entry/copy_function_catalog_entry.hpp"
 #include "duckdb/common/exception.hpp"
+#include "duckdb/common/file_system.hpp"
+#include "duckdb/common/map.hpp"
 #include "duckdb/common/string_util.hpp"
+#include "duckdb/common/types/column/column_data_collection.hpp"
+#include "duckdb/common/types/hash.hpp"
+#include "duckdb/common/types/uuid.hpp"
+#include "duckdb/common/unordered_set.hpp"
+#include "duckdb/execution/expression_executor.hpp"
+#include "duckdb/function/copy_function.hpp"
+#include "duckdb/function/replacement_scan.hpp"
 #include "duckdb/function/scalar_function.hpp"
 #include "duckdb/function/table_function.hpp"
+#include "duckdb/main/config.hpp"
 #include "duckdb/main/extension_util.hpp"
+#include "duckdb/parser/expression/columnref_expression.hpp"
+#include "duckdb/parser/expression/constant_expression.hpp"
+#include "duckdb/parser/expression/function_expression.hpp"
+#include "duckdb/parser/parsed_data/copy_info.hpp"
+#include "duckdb/parser/query_node.hpp"
+#include "duckdb/parser/result_modifier.hpp"
+#include "duckdb/parser/tableref/table_function_ref.hpp"
+#include "duckdb/planner/expression/bound_conjunction_expression.hpp"
+#include "duckdb/planner/expression/bound_constant_expression.hpp"
+#include "duckdb/planner/expression/bound_reference_expression.hpp"
+#include "duckdb/planner/filter/conjunction_filter.hpp"
+#include "duckdb/planner/filter/constant_filter.hpp"
+#include "duckdb/planner/filter/dynamic_filter.hpp"
+#include "duckdb/planner/filter/in_filter.hpp"
+#include "duckdb/planner/filter/optional_filter.hpp"
+#include "duckdb/planner/table_filter.hpp"
+#include "duckdb/storage/buffer_manager.hpp"
+#include "duckdb/storage/statistics/node_statistics.hpp"
+#include "duckdb/storage/statistics/numeric_stats.hpp"
+#include "duckdb/storage/statistics/string_stats.hpp"
 #include <duckdb/parser/parsed_data/create_scalar_function_info.hpp>
 #include <duckdb/parser/parsed_data/create_table_function_info.hpp>
+#include <algorithm>
 
 // OpenSSL linked through vcpkg
 #include <openssl/opensslv.h>
 
 namespace duckdb {
 
+// Rows handed to a thread at a time when the file supports parallel reads
+static constexpr idx_t STATA_ROWS_PER_TASK = STANDARD_VECTOR_SIZE * 60;
+
 // Stata DTA table function data
 struct StataDtaBindData : public TableFunctionData {
-	unique_ptr<StataReader> reader;
-	std::string filename;
+	// Files to scan. Later files must have the variables of the first.
+	vector<string> files;
 	vector<LogicalType> types;
 	vector<string> names;
+	// Header of the first file
+	StataHeader header;
+	// Columns up to here are Stata variables, the rest are hive partition keys
+	idx_t variable_count = 0;
+	// Per file, the value of each partition key
+	vector<vector<Value>> partition_values;
+	// Pipes, FIFOs and /dev/stdin can only be read once, so the reader opened at
+	// bind time is handed to the scan instead of reopening the file
+	mutable mutex reader_lock;
+	mutable unique_ptr<StataReader> stream_reader;
+	// Schema cache named by stata_schema_cache, if set; also used for the files after the first
+	shared_ptr<StataSchemaCache> schema_cache;
+	// With cache_dir, the Parquet copy that the first scan reading the whole file
+	// writes, and the function writing it; empty if the file is read directly
+	string cache_dir;
+	string cache_path;
+	unique_ptr<CopyFunction> parquet_function;
+	// Per file, the scan's number among the query's scans of it; see StataSharedScans
+	vector<idx_t> shared_scans;
 };
 
-// Stata DTA table function
-static unique_ptr<FunctionData> StataDtaBind(ClientContext &context, TableFunctionBindInput &input, vector<LogicalType> &return_types, vector<string> &names) {
-	auto result = make_uniq<StataDtaBindData>();
-	
-	// Get filename from arguments
-	if (input.inputs.empty() || input.inputs[0].IsNull()) {
-		throw InvalidInputException("read_stata_dta requires a filename argument");
+// Paths of copies this process is writing
+static mutex stata_copies_lock;
+static unordered_set<string> stata_copies_writing;
+
+// Parquet copy of a file, written from the rows its first scan decodes. Tasks
+// hand in their rows by batch index; runs of consecutive batches are encoded in
+// parallel and written in file order. The copy gets a temporary name and is
+// moved into place once every row is written, so a scan that stops early
+// (LIMIT, an error) leaves no copy behind.
+class StataCachedCopyWriter {
+public:
+	StataCachedCopyWriter(FileSystem &fs, string cache_path) : fs(fs), cache_path(std::move(cache_path)) {
 	}
-	
-	result->filename = StringValue::Get(input.inputs[0]);
-	
-	// Create and open reader
-	result->reader = make_uniq<StataReader>(result->filename);
-	if (!result->reader->Open()) {
-		throw IOException("Cannot open Stata file: " + result->filename);
+	~StataCachedCopyWriter();
+
+	// nullptr if the copy exists by now, or another thread or process is writing it
+	static unique_ptr<StataCachedCopyWriter> Begin(ClientContext &context, const StataDtaBindData &bind_data);
+
+	// Rows of a batch the scan handed out; every batch is added exactly once
+	void AddBatch(ClientContext &context, idx_t batch, unique_ptr<ColumnDataCollection> rows);
+	// Called once all batches are handed out, with their number
+	void SetBatchCount(ClientContext &context, idx_t count);
+
+private:
+	FileSystem &fs;
+	string cache_path;
+	string temp_path;
+	// Held until the copy is in place; other processes read the file directly meanwhile
+	unique_ptr<FileHandle> lock_file;
+	unique_ptr<CopyFunction> function;
+	unique_ptr<FunctionData> bind_data;
+	unique_ptr<GlobalFunctionData> global_state;
+
+	mutex lock;
+	// Batches waiting for the ones before them, and the run they are appended to
+	map<idx_t, unique_ptr<ColumnDataCollection>> batches;
+	idx_t next_batch = 0;
+	idx_t batch_count = DConstants::INVALID_INDEX;
+	unique_ptr<ColumnDataCollection> run;
+	// Encoded runs waiting for the ones before them
+	map<idx_t, unique_ptr<PreparedBatchData>> prepared;
+	idx_t run_count = 0;
+	idx_t next_flush = 0;
+	bool all_runs = false;
+	bool finished = false;
+
+	// Moves the batches that are next in order to the run, and returns the runs
+	// that are complete with their numbers. Called with the lock held.
+	vector<std::pair<idx_t, unique_ptr<ColumnDataCollection>>> TakeRuns();
+	// Encodes runs, writes those that are next in order and finishes the copy after the last
+	void WriteRuns(ClientContext &context, vector<std::pair<idx_t, unique_ptr<ColumnDataCollection>>> runs);
+};
+
+// One file of a scan
+struct StataDtaFileScan {
+	idx_t file = 0;
+	// Cache the file's decoded row groups go to, and its key there; empty if
+	// its rows are not cached
+	shared_ptr<StataColumnCache> column_cache;
+	string fingerprint;
+	// Otherwise, row groups shared with the query's other scans of the file, and
+	// this scan's number among them
+	shared_ptr<StataSharedScans> shared;
+	idx_t shared_scan = 0;
+	// Shared by all threads when the source can only be read front to back;
+	// released once all of the file's rows are handed out
+	unique_ptr<StataReader> reader;
+	bool parallel = false;
+	idx_t next_row = 0;
+	// End of the rows to scan; may be narrowed by filters on the sort key
+	idx_t total_rows = 0;
+	// With a key index, next_row and total_rows count into these row numbers
+	bool use_rows = false;
+	std::vector<idx_t> rows;
+	// First variable of the file's sort order, if it has one and is read in parallel
+	idx_t sort_column = DConstants::INVALID_INDEX;
+};
+
+// A filter whose bound is set while the query runs, e.g. the threshold of
+// ORDER BY ... LIMIT k once k rows have been seen
+struct StataDynamicFilter {
+	// Position in column_ids, and the variable
+	idx_t index;
+	idx_t column;
+	shared_ptr<DynamicFilterData> data;
+};
+
+struct StataDtaGlobalState : public GlobalTableFunctionState {
+	mutex lock;
+	// Files left after partition pruning, and the next one to open
+	vector<idx_t> files;
+	idx_t next_file = 0;
+	// Files opened so far; rows are handed out from current
+	vector<unique_ptr<StataDtaFileScan>> scans;
+	optional_ptr<StataDtaFileScan> current;
+	vector<column_t> column_ids;
+	optional_ptr<TableFilterSet> filters;
+	// Decoded row groups shared across queries, if stata_column_cache_size is set
+	shared_ptr<StataColumnCache> column_cache;
+	// Otherwise, files also read by other scans of the query share their row
+	// groups; each file with this scan's number among its scans
+	shared_ptr<StataSharedScans> shared_scans;
+	vector<std::pair<string, idx_t>> shared_files;
+	idx_t max_threads = 1;
+	// Batch index of the next task; tasks are numbered in file and row order
+	idx_t next_batch = 0;
+	// Pushed-down filters on variables, evaluated on every chunk
+	unique_ptr<Expression> filter;
+	// Dynamic filters among the pushed-down filters, re-read for every chunk
+	vector<StataDynamicFilter> dynamic_filters;
+	// Projected variables no filter refers to, decoded only for the rows that
+	// pass the filters; empty if there are none
+	std::vector<bool> deferred;
+	// Where forward-only inputs with strL variables are spilled, and how much they may spill
+	StataSpillOptions spill;
+	// Parquet copy written from the scanned rows, if the scan writes one. Every
+	// variable of every row is then decoded, whatever the projection and filters.
+	unique_ptr<StataCachedCopyWriter> copy;
+
+	~StataDtaGlobalState() override {
+		// Row groups kept for files this scan never got to are released too
+		for (auto &file : shared_files) {
+			shared_scans->Finish(file.first, file.second);
+		}
+	}
+
+	idx_t MaxThreads() const override {
+		return max_threads;
+	}
+};
+
+struct StataDtaLocalState : public LocalTableFunctionState {
+	// File the thread's rows come from, and a private cursor over it in parallel mode
+	optional_ptr<StataDtaFileScan> scan;
+	unique_ptr<StataReader> cursor;
+	idx_t row_start = 0;
+	idx_t row_end = 0;
+	// Batch index of the task the current chunk belongs to
+	idx_t batch_index = 0;
+	// First row of the current chunk, and whether its deferred variables are still to decode
+	idx_t chunk_start = 0;
+	bool late = false;
+	// The chunk's deferred columns: gstate.deferred, or those of them the column cache missed
+	optional_ptr<const std::vector<bool>> deferred;
+	// Projected columns of the current chunk that were served by the column cache,
+	// and deferred columns it missed
+	std::vector<bool> cached;
+	std::vector<bool> missed;
+	unique_ptr<ExpressionExecutor> filter;
+	SelectionVector sel;
+	// Bounds of the dynamic filters the executor was built with, and the
+	// expression it evaluates once any of them is set
+	vector<unique_ptr<TableFilter>> dynamic_bounds;
+	unique_ptr<Expression> dynamic_filter;
+	// When writing a copy: every variable of the current chunk, and the rows of
+	// the current batch
+	DataChunk variables;
+	unique_ptr<ColumnDataCollection> copy_rows;
+};
+
+// Spills go to DuckDB's temp_directory; none are made if it is not set. Each
+// file's spill must fit in max_temp_directory_size on its own, but is not
+// counted with DuckDB's own temporary files or other scans' spills.
+static StataSpillOptions StataGetSpillOptions(ClientContext &context) {
+	StataSpillOptions result;
+	result.directory = BufferManager::GetBufferManager(context).GetTemporaryDirectory();
+	auto &max_swap = DBConfig::GetConfig(context).options.maximum_swap_space;
+	if (max_swap.IsValid()) {
+		result.max_bytes = max_swap.GetIndex();
+	}
+	return result;
+}
+
+// Expands a glob to the matching files; other paths (including pipes) are used as given
+static vector<string> StataExpandFiles(ClientContext &context, const Value &pattern_value, const string &function) {
+	if (pattern_value.IsNull()) {
+		throw InvalidInputException("%s requires a filename argument", function);
+	}
+	auto pattern = StringValue::Get(pattern_value);
+	auto &fs = FileSystem::GetFileSystem(context);
+	if (!FileSystem::HasGlob(pattern)) {
+		return {pattern};
+	}
+	vector<string> files;
+	for (auto &file : fs.GlobFiles(pattern, context, FileGlobOptions::DISALLOW_EMPTY)) {
+		files.push_back(file.path);
+	}
+	return files;
+}
+
+// Schema caches the running query looked files up in. The entries they recorded
+// are written once when the query ends, not by every bind.
+struct StataSchemaCacheFlush : public ClientContextState {
+	mutex lock;
+	vector<shared_ptr<StataSchemaCache>> caches;
+
+	void QueryEnd(ClientContext &context) override {
+		lock_guard<mutex> guard(lock);
+		for (auto &cache : caches) {
+			try {
+				cache->Flush();
+			} catch (std::exception &) {
+				// The cache only saves work; a query that succeeded does not fail
+				// because its entries could not be written
+			}
+		}
+		caches.clear();
+	}
+};
+
+// Schema cache named by the stata_schema_cache setting, if it is set
+static shared_ptr<StataSchemaCache> StataGetSchemaCache(ClientContext &context) {
+	Value path;
+	if (!context.TryGetCurrentSetting("stata_schema_cache", path) || path.IsNull() ||
+	    StringValue::Get(path).empty()) {
+		return nullptr;
+	}
+	auto cache = StataSchemaCache::Get(StringValue::Get(path));
+	auto flush = context.registered_state->GetOrCreate<StataSchemaCacheFlush>("stata_schema_cache_flush");
+	lock_guard<mutex> guard(flush->lock);
+	if (std::find(flush->caches.begin(), flush->caches.end(), cache) == flush->caches.end()) {
+		flush->caches.push_back(cache);
+	}
+	return cache;
+}
+
+// Reads the schema of the first file, from the schema cache when there is one
+static unique_ptr<StataDtaBindData> StataBindFiles(vector<string> files, shared_ptr<StataSchemaCache> cache,
+                                                   vector<LogicalType> &return_types, vector<string> &names) {
+	auto result = make_uniq<StataDtaBindData>();
+	result->files = std::move(files);
+	result->schema_cache = std::move(cache);
+	auto &filename = result->files[0];
+
+	shared_ptr<const StataSchema> schema = result->schema_cache ? result->schema_cache->Lookup(filename) : nullptr;
+	unique_ptr<StataReader> reader;
+	if (!schema) {
+		// Open the file to read its metadata
+		reader = make_uniq<StataReader>(filename);
+		if (!reader->Open()) {
+			throw IOException("Cannot open Stata file: " + filename);
+		}
 	}
 	
 	// Get metadata from file
-	const auto& variables = result->reader->GetVariables();
-	const auto& header = result->reader->GetHeader();
+	const auto& variables = schema ? schema->variables : reader->GetVariables();
+	result->header = schema ? schema->header : reader->GetHeader();
 	
 	// Set up return types and names
 	for (const auto& var : variables) {
-		return_types.push_back(result->reader->StataTypeToLogicalType(var));
+		return_types.push_back(StataParser::StataTypeToLogicalType(var));
 		names.push_back(var.name);
 	}
 	
 	result->types = return_types;
 	result->names = names;
+	result->variable_count = variables.size();
 	
+	if (reader && result->files.size() == 1 && !StataIsRegularFile(filename)) {
+		result->stream_reader = std::move(reader);
+	}
+	
+	return result;
+}
+
+unique_ptr<FunctionData> StataBindFile(optional_ptr<ClientContext> context, const std::string &filename,
+                                       vector<LogicalType> &return_types, vector<string> &names) {
+	return StataBindFiles({filename}, context ? StataGetSchemaCache(*context) : nullptr, return_types, names);
+}
+
+// key=value directories in path, outermost first
+static vector<std::pair<string, string>> StataParsePartitions(const string &path) {
+	vector<std::pair<string, string>> result;
+	idx_t start = 0;
+	for (idx_t i = 0; i < path.size(); i++) {
+		if (path[i] != '/' && path[i] != '\\') {
+			continue;
+		}
+		auto segment = path.substr(start, i - start);
+		auto equals = segment.find('=');
+		if (equals != string::npos && equals > 0) {
+			result.emplace_back(segment.substr(0, equals), segment.substr(equals + 1));
+		}
+		start = i + 1;
+	}
+	return result;
+}
+
+static bool StataIsHiveNull(const string &value) {
+	return value == "NULL" || value == "__HIVE_DEFAULT_PARTITION__";
+}
+
+static bool StataIsHiveInteger(const string &value) {
+	idx_t digits = !value.empty() && value[0] == '-' ? 1 : 0;
+	if (value.size() == digits || value.size() - digits > 18) {
+		return false;
+	}
+	for (idx_t i = digits; i < value.size(); i++) {
+		if (!StringUtil::CharacterIsDigit(value[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Adds a column per key=value directory. Without an explicit hive_partitioning
+// option this happens only if every file has the same keys in the same order
+// and none of them is also a variable. Keys whose values are all integers are
+// BIGINT, the others VARCHAR.
+static void StataBindPartitions(StataDtaBindData &bind_data, const Value &option, vector<LogicalType> &return_types,
+                                vector<string> &names) {
+	bool is_explicit = !option.IsNull();
+	if (is_explicit && !BooleanValue::Get(option)) {
+		return;
+	}
+	auto &files = bind_data.files;
+	vector<vector<std::pair<string, string>>> partitions;
+	for (auto &file : files) {
+		partitions.push_back(StataParsePartitions(file));
+	}
+	auto &keys = partitions[0];
+	if (keys.empty()) {
+		if (is_explicit) {
+			throw InvalidInputException("hive_partitioning is set but \"%s\" has no key=value directories", files[0]);
+		}
+		return;
+	}
+	for (idx_t file = 1; file < files.size(); file++) {
+		bool same = partitions[file].size() == keys.size();
+		for (idx_t key = 0; same && key < keys.size(); key++) {
+			same = StringUtil::CIEquals(partitions[file][key].first, keys[key].first);
+		}
+		if (!same) {
+			if (is_explicit) {
+				throw InvalidInputException("Hive partitions of \"%s\" do not match those of \"%s\"", files[file],
+				                            files[0]);
+			}
+			return;
+		}
+	}
+
+	for (auto &key : keys) {
+		for (auto &name : names) {
+			if (!StringUtil::CIEquals(name, key.first)) {
+				continue;
+			}
+			if (is_explicit) {
+				throw BinderException("Hive partition key \"%s\" is also a variable of \"%s\"", key.first,
+				                      files[0]);
+			}
+			return;
+		}
+	}
+
+	vector<LogicalType> key_types;
+	for (idx_t key = 0; key < keys.size(); key++) {
+		bool integer = true;
+		for (auto &file_partitions : partitions) {
+			auto &value = file_partitions[key].second;
+			integer = integer && (StataIsHiveNull(value) || StataIsHiveInteger(value));
+		}
+		key_types.push_back(integer ? LogicalType::BIGINT : LogicalType::VARCHAR);
+		names.push_back(keys[key].first);
+		return_types.push_back(key_types.back());
+	}
+	for (auto &file_partitions : partitions) {
+		vector<Value> values;
+		for (idx_t key = 0; key < keys.size(); key++) {
+			auto &value = file_partitions[key].second;
+			values.push_back(StataIsHiveNull(value) ? Value(key_types[key]) : Value(value).DefaultCastAs(key_types[key]));
+		}
+		bind_data.partition_values.push_back(std::move(values));
+	}
+	bind_data.types = return_types;
+	bind_data.names = names;
+}
+
+// Columnar copy of filename in cache_dir, named after the file and a hash of its
+// absolute path, size and modification time so a rewritten file gets a new copy
+static string StataCachePath(FileSystem &fs, const string &cache_dir, const string &filename) {
+	uint64_t size;
+	int64_t mtime;
+	if (!StataFileStamp(filename, size, mtime)) {
+		return string();
+	}
+	auto key = StataAbsolutePath(filename) + "|" + std::to_string(size) + "|" + std::to_string(mtime);
+	auto hash = Hash(key.c_str(), key.size());
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+	auto name = fs.ExtractBaseName(filename);
+	return fs.JoinPath(cache_dir, name + "-" + hex + ".parquet");
+}
+
+// Path of the Parquet copy of the scanned file with cache_dir or the
+// stata_cache_dir setting, and the directory; empty if the file is always read directly
+static string StataCachedCopyPath(ClientContext &context, TableFunctionBindInput &input, string &cache_dir) {
+	Value cache_dir_value;
+	auto cache_dir_option = input.named_parameters.find("cache_dir");
+	if (cache_dir_option != input.named_parameters.end()) {
+		cache_dir_value = cache_dir_option->second;
+	} else if (!context.TryGetCurrentSetting("stata_cache_dir", cache_dir_value)) {
+		return string();
+	}
+	if (cache_dir_value.IsNull() || StringValue::Get(cache_dir_value).empty() || input.inputs.empty() ||
+	    input.inputs[0].IsNull()) {
+		return string();
+	}
+	cache_dir = StringValue::Get(cache_dir_value);
+	auto filename = StringValue::Get(input.inputs[0]);
+	auto hive_partitioning = input.named_parameters.find("hive_partitioning");
+	bool hive_disabled = hive_partitioning != input.named_parameters.end() && !hive_partitioning->second.IsNull() &&
+	                     !BooleanValue::Get(hive_partitioning->second);
+	// Globs, pipes and files with partition columns from their path are read directly
+	if (FileSystem::HasGlob(filename) || (!hive_disabled && !StataParsePartitions(filename).empty())) {
+		return string();
+	}
+	return StataCachePath(FileSystem::GetFileSystem(context), cache_dir, filename);
+}
+
+// Stata DTA table function
+static unique_ptr<FunctionData> StataDtaBind(ClientContext &context, TableFunctionBindInput &input, vector<LogicalType> &return_types, vector<string> &names) {
+	// Get filename from arguments
+	if (input.inputs.empty() || input.inputs[0].IsNull()) {
+		throw InvalidInputException("read_stata_dta requires a filename argument");
+	}
+	auto result = StataBindFiles(StataExpandFiles(context, input.inputs[0], "read_stata_dta"),
+	                             StataGetSchemaCache(context), return_types, names);
+	auto hive_partitioning = input.named_parameters.find("hive_partitioning");
+	StataBindPartitions(*result, hive_partitioning == input.named_parameters.end() ? Value() : hive_partitioning->second,
+	                    return_types, names);
+	StataRegisterScan(context, *result);
+	// StataDtaBindReplace reads an existing copy; otherwise the scan may write it
+	result->cache_path = StataCachedCopyPath(context, input, result->cache_dir);
+	if (!result->cache_path.empty()) {
+		auto &entry = Catalog::GetEntry<CopyFunctionCatalogEntry>(context, INVALID_CATALOG, DEFAULT_SCHEMA, "parquet");
+		result->parquet_function = make_uniq<CopyFunction>(entry.function);
+	}
+	return std::move(result);
+}
+
+StataCachedCopyWriter::~StataCachedCopyWriter() {
+	if (global_state && !finished) {
+		global_state.reset();
+		fs.TryRemoveFile(temp_path);
+	}
+	if (lock_file) {
+		lock_file.reset();
+		fs.TryRemoveFile(cache_path + ".lock");
+	}
+	lock_guard<mutex> guard(stata_copies_lock);
+	stata_copies_writing.erase(cache_path);
+}
+
+unique_ptr<StataCachedCopyWriter> StataCachedCopyWriter::Begin(ClientContext &context,
+                                                               const StataDtaBindData &bind_data) {
+	auto &fs = FileSystem::GetFileSystem(context);
+	if (fs.FileExists(bind_data.cache_path)) {
+		// Written since the scan was bound
+		return nullptr;
+	}
+	{
+		lock_guard<mutex> guard(stata_copies_lock);
+		if (!stata_copies_writing.insert(bind_data.cache_path).second) {
+			return nullptr;
+		}
+	}
+	auto result = make_uniq<StataCachedCopyWriter>(fs, bind_data.cache_path);
+	if (!fs.DirectoryExists(bind_data.cache_dir)) {
+		fs.CreateDirectory(bind_data.cache_dir);
+	}
+
+	// Creating the lock file fails like any other write to the directory. Taking
+	// the lock does not wait: if another process holds it, this scan reads the
+	// file directly. The OS releases the lock if its holder dies, so a crash
+	// never blocks later copies.
+	auto lock_path = result->cache_path + ".lock";
+	fs.OpenFile(lock_path, FileFlags::FILE_FLAGS_WRITE | FileFlags::FILE_FLAGS_FILE_CREATE);
+	try {
+		result->lock_file = fs.OpenFile(lock_path, FileFlags::FILE_FLAGS_WRITE | FileFlags::FILE_FLAGS_FILE_CREATE |
+		                                               FileLockType::WRITE_LOCK);
+	} catch (IOException &) {
+		return nullptr;
+	}
+	if (fs.FileExists(result->cache_path)) {
+		// Another process finished it before this one took the lock
+		return nullptr;
+	}
+
+	// Written under a unique name and moved into place, so concurrent scans
+	// never read a partial copy
+	result->temp_path = result->cache_path + "." + UUID::ToString(UUID::GenerateRandomUUID()) + ".tmp";
+	result->function = make_uniq<CopyFunction>(*bind_data.parquet_function);
+	CopyInfo info;
+	info.format = "parquet";
+	info.file_path = result->temp_path;
+	CopyFunctionBindInput input(info);
+	vector<string> names(bind_data.names.begin(), bind_data.names.begin() + bind_data.variable_count);
+	vector<LogicalType> types(bind_data.types.begin(), bind_data.types.begin() + bind_data.variable_count);
+	result->bind_data = result->function->copy_to_bind(context, input, names, types);
+	result->global_state = result->function->copy_to_initialize_global(context, *result->bind_data, result->temp_path);
+	return result;
+}
+
+vector<std::pair<idx_t, unique_ptr<ColumnDataCollection>>> StataCachedCopyWriter::TakeRuns() {
+	vector<std::pair<idx_t, unique_ptr<ColumnDataCollection>>> result;
+	auto entry = batches.find(next_batch);
+	while (entry != batches.end()) {
+		if (!run) {
+			run = std::move(entry->second);
+		} else {
+			run->Combine(*entry->second);
+		}
+		batches.erase(entry);
+		next_batch++;
+		// Runs of STATA_ROWS_PER_TASK rows become Parquet row groups
+		if (run->Count() >= STATA_ROWS_PER_TASK) {
+			result.emplace_back(run_count++, std::move(run));
+		}
+		entry = batches.find(next_batch);
+	}
+	if (next_batch == batch_count && !all_runs) {
+		if (run && run->Count() > 0) {
+			result.emplace_back(run_count++, std::move(run));
+		}
+		all_runs = true;
+	}
+	return result;
+}
+
+void StataCachedCopyWriter::WriteRuns(ClientContext &context,
+                                      vector<std::pair<idx_t, unique_ptr<ColumnDataCollection>>> runs) {
+	for (auto &entry : runs) {
+		auto batch = function->prepare_batch(context, *bind_data, *global_state, std::move(entry.second));
+		lock_guard<mutex> guard(lock);
+		prepared[entry.first] = std::move(batch);
+	}
+	lock_guard<mutex> guard(lock);
+	auto entry = prepared.find(next_flush);
+	while (entry != prepared.end()) {
+		function->flush_batch(context, *bind_data, *global_state, *entry->second);
+		prepared.erase(entry);
+		entry = prepared.find(++next_flush);
+	}
+	if (all_runs && next_flush == run_count && !finished) {
+		function->copy_to_finalize(context, *bind_data, *global_state);
+		global_state.reset();
+		fs.MoveFile(temp_path, cache_path);
+		finished = true;
+	}
+}
+
+void StataCachedCopyWriter::AddBatch(ClientContext &context, idx_t batch, unique_ptr<ColumnDataCollection> rows) {
+	vector<std::pair<idx_t, unique_ptr<ColumnDataCollection>>> runs;
+	{
+		lock_guard<mutex> guard(lock);
+		batches[batch] = std::move(rows);
+		runs = TakeRuns();
+	}
+	WriteRuns(context, std::move(runs));
+}
+
+void StataCachedCopyWriter::SetBatchCount(ClientContext &context, idx_t count) {
+	vector<std::pair<idx_t, unique_ptr<ColumnDataCollection>>> runs;
+	{
+		lock_guard<mutex> guard(lock);
+		if (batch_count != DConstants::INVALID_INDEX) {
+			return;
+		}
+		batch_count = count;
+		runs = TakeRuns();
+	}
+	WriteRuns(context, std::move(runs));
+}
+
+// With cache_dir, a single Stata file whose Parquet copy exists is read from the
+// copy, with Parquet's compression, row group statistics and column pruning
+// instead of decoding fixed-width rows. The copy is written by the first scan
+// that reads the whole file (see StataCachedCopyWriter), never while binding.
+static unique_ptr<TableRef> StataDtaBindReplace(ClientContext &context, TableFunctionBindInput &input) {
+	string cache_dir;
+	auto cache_path = StataCachedCopyPath(context, input, cache_dir);
+	if (cache_path.empty() || !FileSystem::GetFileSystem(context).FileExists(cache_path)) {
+		return nullptr;
+	}
+	auto table_function = make_uniq<TableFunctionRef>();
+	vector<unique_ptr<ParsedExpression>> children;
+	children.push_back(make_uniq<ConstantExpression>(Value(cache_path)));
+	table_function->function = make_uniq<FunctionExpression>("read_parquet", std::move(children));
+	return std::move(table_function);
+}
+
+static void StataCollectBounds(const TableFilter &filter, vector<reference<const ConstantFilter>> &bounds) {
+	switch (filter.filter_type) {
+	case TableFilterType::CONSTANT_COMPARISON:
+		bounds.push_back(filter.Cast<ConstantFilter>());
+		break;
+	case TableFilterType::CONJUNCTION_AND:
+		for (auto &child : filter.Cast<ConjunctionAndFilter>().child_filters) {
+			StataCollectBounds(*child, bounds);
+		}
+		break;
+	case TableFilterType::OPTIONAL_FILTER: {
+		auto &child = filter.Cast<OptionalFilter>().child_filter;
+		if (child) {
+			StataCollectBounds(*child, bounds);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+// Dynamic filters within filter
+static void StataCollectDynamicFilters(const TableFilter &filter, vector<shared_ptr<DynamicFilterData>> &result) {
+	switch (filter.filter_type) {
+	case TableFilterType::DYNAMIC_FILTER: {
+		auto &data = filter.Cast<DynamicFilter>().filter_data;
+		if (data) {
+			result.push_back(data);
+		}
+		break;
+	}
+	case TableFilterType::CONJUNCTION_AND:
+		for (auto &child : filter.Cast<ConjunctionAndFilter>().child_filters) {
+			StataCollectDynamicFilters(*child, result);
+		}
+		break;
+	case TableFilterType::OPTIONAL_FILTER: {
+		auto &child = filter.Cast<OptionalFilter>().child_filter;
+		if (child) {
+			StataCollectDynamicFilters(*child, result);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+// The current bound of a dynamic filter, or nullptr while it has none
+static unique_ptr<TableFilter> StataDynamicBound(DynamicFilterData &data) {
+	lock_guard<mutex> guard(data.lock);
+	if (!data.initialized || !data.filter) {
+		return nullptr;
+	}
+	return data.filter->Copy();
+}
+
+// Keys an equality or IN filter restricts the column to. Returns false if the
+// filter admits other values.
+static bool StataCollectKeys(const TableFilter &filter, vector<Value> &keys) {
+	switch (filter.filter_type) {
+	case TableFilterType::CONSTANT_COMPARISON: {
+		auto &constant = filter.Cast<ConstantFilter>();
+		if (constant.comparison_type != ExpressionType::COMPARE_EQUAL) {
+			return false;
+		}
+		keys.push_back(constant.constant);
+		return true;
+	}
+	case TableFilterType::IN_FILTER:
+		for (auto &value : filter.Cast<InFilter>().values) {
+			keys.push_back(value);
+		}
+		return true;
+	case TableFilterType::CONJUNCTION_OR: {
+		for (auto &child : filter.Cast<ConjunctionOrFilter>().child_filters) {
+			if (!StataCollectKeys(*child, keys)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	case TableFilterType::CONJUNCTION_AND:
+		// Any one restricting child is enough, the others are still evaluated
+		for (auto &child : filter.Cast<ConjunctionAndFilter>().child_filters) {
+			vector<Value> child_keys;
+			if (StataCollectKeys(*child, child_keys)) {
+				keys = std::move(child_keys);
+				return true;
+			}
+		}
+		return false;
+	case TableFilterType::OPTIONAL_FILTER: {
+		auto &child = filter.Cast<OptionalFilter>().child_filter;
+		return child && StataCollectKeys(*child, keys);
+	}
+	default:
+		return false;
+	}
+}
+
+// First row in [begin, end) for which past_bound holds; it must be false for
+// some prefix of the range and true for the rest
+template <class OP>
+static idx_t StataFirstRow(StataReader &cursor, idx_t column, idx_t begin, idx_t end, OP past_bound) {
+	while (begin < end) {
+		idx_t middle = begin + (end - begin) / 2;
+		if (past_bound(cursor.ReadValue(middle, column))) {
+			end = middle;
+		} else {
+			begin = middle + 1;
+		}
+	}
+	return begin;
+}
+
+// Narrows [begin, end) to the rows that can match filter on the column the
+// file is sorted by, with O(log n) positioned reads. Missing values sort last.
+static void StataNarrowSortedRange(StataReader &cursor, idx_t column, const TableFilter &filter, idx_t &begin,
+                                   idx_t &end) {
+	vector<reference<const ConstantFilter>> bounds;
+	StataCollectBounds(filter, bounds);
+	for (auto &bound_ref : bounds) {
+		auto &bound = bound_ref.get();
+		auto &constant = bound.constant;
+		switch (bound.comparison_type) {
+		case ExpressionType::COMPARE_EQUAL:
+		case ExpressionType::COMPARE_GREATERTHANOREQUALTO:
+			begin = StataFirstRow(cursor, column, begin, end,
+			                      [&](const Value &value) { return value.IsNull() || value >= constant; });
+			break;
+		case ExpressionType::COMPARE_GREATERTHAN:
+			begin = StataFirstRow(cursor, column, begin, end,
+			                      [&](const Value &value) { return value.IsNull() || value > constant; });
+			break;
+		default:
+			break;
+		}
+		switch (bound.comparison_type) {
+		case ExpressionType::COMPARE_EQUAL:
+		case ExpressionType::COMPARE_LESSTHANOREQUALTO:
+			end = StataFirstRow(cursor, column, begin, end,
+			                    [&](const Value &value) { return value.IsNull() || value > constant; });
+			break;
+		case ExpressionType::COMPARE_LESSTHAN:
+			end = StataFirstRow(cursor, column, begin, end,
+			                    [&](const Value &value) { return value.IsNull() || value >= constant; });
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Checks that a file after the first has the variables the scan was bound with
+static void StataCheckSchema(const StataDtaBindData &bind_data, const std::vector<StataVariable> &variables,
+                             const string &filename) {
+	bool same = variables.size() == bind_data.variable_count;
+	for (idx_t i = 0; same && i < variables.size(); i++) {
+		same = variables[i].name == bind_data.names[i] &&
+		       StataParser::StataTypeToLogicalType(variables[i]) == bind_data.types[i];
+	}
+	if (!same) {
+		throw InvalidInputException("Stata file \"%s\" does not have the variables of \"%s\"", filename,
+		                            bind_data.files[0]);
+	}
+}
+
+static unique_ptr<StataDtaFileScan> StataDtaOpenFile(const StataDtaBindData &bind_data,
+                                                     const StataDtaGlobalState &gstate, idx_t file) {
+	auto &filename = bind_data.files[file];
+	auto result = make_uniq<StataDtaFileScan>();
+	result->file = file;
+
+	// With a schema cache, files are checked against the cached schema, and
+	// scans that read no variables (COUNT(*)) take the row count from it
+	// without opening the file
+	bool checked = file == 0;
+	if (bind_data.schema_cache && StataIsRegularFile(filename)) {
+		auto schema = bind_data.schema_cache->Lookup(filename);
+		if (schema && !checked) {
+			StataCheckSchema(bind_data, schema->variables, filename);
+			checked = true;
+		}
+		bool reads_variables = false;
+		for (auto column : gstate.column_ids) {
+			reads_variables = reads_variables || column < bind_data.variable_count;
+		}
+		if (schema && !reads_variables && !gstate.copy) {
+			result->total_rows = schema->header.nobs;
+			result->parallel = true;
+			return result;
+		}
+	}
+
+	if (!StataIsRegularFile(filename)) {
+		lock_guard<mutex> guard(bind_data.reader_lock);
+		if (!bind_data.stream_reader) {
+			throw InvalidInputException("Stata input \"%s\" is not a regular file and can only be scanned once",
+			                            filename);
+		}
+		result->reader = std::move(bind_data.stream_reader);
+	} else {
+		result->reader = make_uniq<StataReader>(filename);
+		if (!result->reader->Open()) {
+			throw IOException("Cannot open Stata file: " + filename);
+		}
+		if (!checked) {
+			StataCheckSchema(bind_data, result->reader->GetVariables(), filename);
+		}
+	}
+	result->total_rows = result->reader->GetHeader().nobs;
+	result->reader->SetSpillOptions(gstate.spill);
+	if (gstate.copy) {
+		// Every row of every variable goes to the copy; StataDtaCopyRows projects them
+		std::vector<idx_t> variables;
+		for (idx_t column = 0; column < bind_data.variable_count; column++) {
+			variables.push_back(column);
+		}
+		result->reader->SetProjection(std::move(variables));
+	} else {
+		// Only the projected variables are decoded; with none (COUNT(*)) rows are only counted
+		result->reader->SetProjection(std::vector<idx_t>(gstate.column_ids.begin(), gstate.column_ids.end()));
+	}
+
+	// Plain files and compressed files with independent frames can be read by
+	// several threads at once; other compressed streams are decoded front to back
+	auto probe = result->reader->OpenCursor();
+	if (!probe) {
+		return result;
+	}
+	result->parallel = true;
+	if (gstate.copy) {
+		return result;
+	}
+	if (gstate.column_cache) {
+		result->column_cache = gstate.column_cache;
+		result->fingerprint = StataColumnCache::Fingerprint(filename);
+	} else if (gstate.shared_scans && file < bind_data.shared_scans.size() &&
+	           gstate.shared_scans->IsShared(filename)) {
+		result->shared = gstate.shared_scans;
+		result->shared_scan = bind_data.shared_scans[file];
+		std::vector<idx_t> variables;
+		for (auto column : gstate.column_ids) {
+			if (column < bind_data.variable_count) {
+				variables.push_back(column);
+			}
+		}
+		result->shared->SetProjection(filename, result->shared_scan, variables);
+	}
+
+	auto &sort_order = result->reader->GetHeader().sort_order;
+	if (!sort_order.empty()) {
+		result->sort_column = sort_order[0];
+	}
+	if (gstate.filters) {
+		for (auto &entry : gstate.filters->filters) {
+			idx_t column = gstate.column_ids[entry.first];
+			if (column >= bind_data.variable_count || result->use_rows) {
+				continue;
+			}
+			// A file sorted by this column only has matches in one contiguous range
+			if (!sort_order.empty() && sort_order[0] == column) {
+				StataNarrowSortedRange(*probe, column, *entry.second, result->next_row, result->total_rows);
+				continue;
+			}
+			// Otherwise a key index built with stata_dta_build_key_index lists the candidate rows
+			vector<Value> keys;
+			if (StataCollectKeys(*entry.second, keys)) {
+				auto index = StataKeyIndex::Open(filename, bind_data.names[column], result->reader->GetHeader().nobs);
+				if (index) {
+					result->rows = index->Lookup(keys);
+					result->use_rows = true;
+					result->next_row = 0;
+					result->total_rows = result->rows.size();
+				}
+			}
+		}
+	}
+	if ((result->column_cache || result->shared) && !result->use_rows && result->next_row < result->total_rows) {
+		// Cached row groups start at multiples of ROW_GROUP_SIZE, so a range narrowed
+		// on the sort key is widened to whole row groups; the filters drop the extra rows
+		auto group = StataColumnCache::ROW_GROUP_SIZE;
+		result->next_row -= result->next_row % group;
+		result->total_rows =
+		    MinValue<idx_t>(result->reader->GetHeader().nobs, (result->total_rows + group - 1) / group * group);
+	}
+	return result;
+}
+
+// Opens the next file left after pruning, returns false when there is none.
+// Called with the lock held.
+static bool StataDtaNextFile(const StataDtaBindData &bind_data, StataDtaGlobalState &gstate) {
+	if (gstate.current) {
+		// All of its rows have been handed out; threads still reading them use their own cursors
+		gstate.current->reader.reset();
+		if (gstate.current->shared) {
+			gstate.current->shared->Finish(bind_data.files[gstate.current->file], gstate.current->shared_scan);
+		}
+		gstate.current = nullptr;
+	}
+	if (gstate.next_file >= gstate.files.size()) {
+		return false;
+	}
+	gstate.scans.push_back(StataDtaOpenFile(bind_data, gstate, gstate.files[gstate.next_file++]));
+	gstate.current = gstate.scans.back().get();
+	return true;
+}
+
+static unique_ptr<GlobalTableFunctionState> StataDtaInitGlobal(ClientContext &context, TableFunctionInitInput &input) {
+	auto &bind_data = input.bind_data->Cast<StataDtaBindData>();
+	auto result = make_uniq<StataDtaGlobalState>();
+	result->column_ids = input.column_ids;
+	result->filters = input.filters;
+	result->spill = StataGetSpillOptions(context);
+	result->column_cache = StataColumnCache::Get(context);
+	if (!result->column_cache) {
+		result->shared_scans = StataSharedScans::Get(context);
+		for (idx_t file = 0; file < bind_data.shared_scans.size(); file++) {
+			result->shared_files.emplace_back(bind_data.files[file], bind_data.shared_scans[file]);
+		}
+	}
+	if (!bind_data.cache_path.empty()) {
+		result->copy = StataCachedCopyWriter::Begin(context, bind_data);
+	}
+
+	// Filters on partition keys decide which files are opened at all; the
+	// others are evaluated on every chunk
+	vector<std::pair<idx_t, reference<TableFilter>>> partition_filters;
+	if (input.filters) {
+		auto conjunction = make_uniq<BoundConjunctionExpression>(ExpressionType::CONJUNCTION_AND);
+		result->deferred.assign(input.column_ids.size(), false);
+		for (idx_t i = 0; i < input.column_ids.size(); i++) {
+			result->deferred[i] = input.column_ids[i] < bind_data.variable_count;
+		}
+		for (auto &entry : input.filters->filters) {
+			idx_t column = input.column_ids[entry.first];
+			result->deferred[entry.first] = false;
+			if (column == COLUMN_IDENTIFIER_ROW_ID) {
+				// The reader fills rowid with the row number, so its filters are evaluated like the others
+				BoundReferenceExpression reference(LogicalType::ROW_TYPE, entry.first);
+				conjunction->children.push_back(entry.second->ToExpression(reference));
+				continue;
+			}
+			if (column < bind_data.variable_count) {
+				vector<shared_ptr<DynamicFilterData>> dynamic_filters;
+				StataCollectDynamicFilters(*entry.second, dynamic_filters);
+				for (auto &data : dynamic_filters) {
+					result->dynamic_filters.push_back(StataDynamicFilter {entry.first, column, std::move(data)});
+				}
+			}
+			if (column >= bind_data.variable_count) {
+				partition_filters.emplace_back(column - bind_data.variable_count, *entry.second);
+				continue;
+			}
+			BoundReferenceExpression reference(bind_data.types[column], entry.first);
+			conjunction->children.push_back(entry.second->ToExpression(reference));
+		}
+		if (conjunction->children.size() == 1) {
+			result->filter = std::move(conjunction->children[0]);
+		} else if (!conjunction->children.empty()) {
+			result->filter = std::move(conjunction);
+		}
+		if (!result->filter || result->copy ||
+		    std::find(result->deferred.begin(), result->deferred.end(), true) == result->deferred.end()) {
+			result->deferred.clear();
+		}
+	}
+	for (idx_t file = 0; file < bind_data.files.size(); file++) {
+		bool matches = true;
+		for (idx_t i = 0; matches && i < partition_filters.size(); i++) {
+			auto &value = bind_data.partition_values[file][partition_filters[i].first];
+			auto expression = partition_filters[i].second.get().ToExpression(BoundConstantExpression(value));
+			auto result_value = ExpressionExecutor::EvaluateScalar(context, *expression);
+			matches = !result_value.IsNull() && BooleanValue::Get(result_value);
+		}
+		if (matches) {
+			result->files.push_back(file);
+		}
+	}
+
+	if (StataDtaNextFile(bind_data, *result) && result->current->parallel) {
+		// Later files are assumed to be as large as the first
+		auto &first = *result->current;
+		idx_t rows = first.total_rows - MinValue(first.next_row, first.total_rows) +
+		             bind_data.header.nobs * (result->files.size() - 1);
+		result->max_threads = MaxValue<idx_t>(1, (rows + STATA_ROWS_PER_TASK - 1) / STATA_ROWS_PER_TASK);
+	}
+	return std::move(result);
+}
+
+void StataRegisterScan(ClientContext &context, FunctionData &bind_data) {
+	auto &data = bind_data.Cast<StataDtaBindData>();
+	auto shared_scans = StataSharedScans::Get(context);
+	data.shared_scans.clear();
+	for (auto &file : data.files) {
+		data.shared_scans.push_back(shared_scans->Register(file));
+	}
+}
+
+idx_t StataBoundRowCount(const FunctionData &bind_data) {
+	return bind_data.Cast<StataDtaBindData>().header.nobs;
+}
+
+static unique_ptr<NodeStatistics> StataDtaCardinality(ClientContext &context, const FunctionData *bind_data_p) {
+	auto &bind_data = bind_data_p->Cast<StataDtaBindData>();
+	idx_t rows = bind_data.header.nobs * bind_data.files.size();
+	if (bind_data.files.size() == 1) {
+		return make_uniq<NodeStatistics>(rows, rows);
+	}
+	return make_uniq<NodeStatistics>(rows);
+}
+
+// What the headers prove about a column: a single empty file has no values,
+// rowid of a single file lies in [0, nobs), and a partition key only takes the
+// values of its directories. Nothing is claimed about the values of variables,
+// which would take reading the data.
+static unique_ptr<BaseStatistics> StataDtaStatistics(ClientContext &context, const FunctionData *bind_data_p,
+                                                     column_t column_index) {
+	auto &bind_data = bind_data_p->Cast<StataDtaBindData>();
+	bool single = bind_data.files.size() == 1;
+	auto nobs = bind_data.header.nobs;
+	if (column_index == COLUMN_IDENTIFIER_ROW_ID) {
+		if (!single) {
+			return nullptr;
+		}
+		if (nobs == 0) {
+			return BaseStatistics::CreateEmpty(LogicalType::ROW_TYPE).ToUnique();
+		}
+		auto stats = NumericStats::CreateEmpty(LogicalType::ROW_TYPE);
+		NumericStats::SetMin(stats, Value::BIGINT(0));
+		NumericStats::SetMax(stats, Value::BIGINT(NumericCast<int64_t>(nobs - 1)));
+		stats.SetHasNoNull();
+		return stats.ToUnique();
+	}
+	if (column_index >= bind_data.types.size()) {
+		return nullptr;
+	}
+	auto &type = bind_data.types[column_index];
+	if (single && nobs == 0) {
+		return BaseStatistics::CreateEmpty(type).ToUnique();
+	}
+	if (column_index < bind_data.variable_count) {
+		return nullptr;
+	}
+	auto stats = BaseStatistics::CreateEmpty(type);
+	for (auto &values : bind_data.partition_values) {
+		auto &value = values[column_index - bind_data.variable_count];
+		if (value.IsNull()) {
+			stats.SetHasNull();
+			continue;
+		}
+		stats.SetHasNoNull();
+		if (type.id() == LogicalTypeId::BIGINT) {
+			NumericStats::Update<int64_t>(stats, BigIntValue::Get(value));
+		} else {
+			StringStats::Update(stats, string_t(StringValue::Get(value)));
+		}
+	}
+	return stats.ToUnique();
+}
+
+static unique_ptr<LocalTableFunctionState> StataDtaInitLocal(ExecutionContext &context, TableFunctionInitInput &input,
+                                                             GlobalTableFunctionState *global_state) {
+	auto &bind_data = input.bind_data->Cast<StataDtaBindData>();
+	auto &gstate = global_state->Cast<StataDtaGlobalState>();
+	auto result = make_uniq<StataDtaLocalState>();
+	if (gstate.filter) {
+		result->filter = make_uniq<ExpressionExecutor>(context.client, *gstate.filter);
+		result->sel.Initialize(STANDARD_VECTOR_SIZE);
+	}
+	if (gstate.copy) {
+		result->variables.Initialize(
+		    context.client,
+		    vector<LogicalType>(bind_data.types.begin(), bind_data.types.begin() + bind_data.variable_count));
+	}
 	return std::move(result);
 }
 
+// Copies the variables of a row group that are in the column cache, decodes the
+// others and adds them to the cache. The rows are not read if all are cached.
+// Deferred variables the cache misses are left to StataDtaDecodeDeferred, which
+// decodes them for the rows that pass the filters only, and are not cached.
+static void StataDtaReadCachedRows(const StataDtaBindData &bind_data, StataDtaGlobalState &gstate,
+                                   StataDtaFileScan &scan, StataDtaLocalState &lstate, idx_t count,
+                                   DataChunk &output) {
+	auto &cache = *scan.column_cache;
+	auto &column_ids = gstate.column_ids;
+	lstate.cached.assign(column_ids.size(), false);
+	for (idx_t i = 0; i < column_ids.size(); i++) {
+		if (column_ids[i] < bind_data.variable_count) {
+			lstate.cached[i] = cache.Fetch(scan.fingerprint, column_ids[i], lstate.row_start, count, output.data[i]);
+		}
+	}
+	auto skip = lstate.cached;
+	if (!gstate.deferred.empty()) {
+		lstate.missed.assign(column_ids.size(), false);
+		for (idx_t i = 0; i < column_ids.size(); i++) {
+			if (gstate.deferred[i] && !lstate.cached[i]) {
+				lstate.missed[i] = true;
+				skip[i] = true;
+				lstate.late = true;
+			}
+		}
+		lstate.deferred = &lstate.missed;
+	}
+	lstate.cursor->ReadRows(lstate.row_start, count, output, &skip);
+	for (idx_t i = 0; i < column_ids.size(); i++) {
+		auto column = column_ids[i];
+		if (column < bind_data.variable_count && !skip[i]) {
+			cache.Store(scan.fingerprint, bind_data.files[scan.file], bind_data.names[column], column,
+			            lstate.row_start, count, output.data[i]);
+		}
+	}
+}
+
+// Like StataDtaReadCachedRows, for row groups shared with the query's other
+// scans of the file. Variables another scan is decoding are waited for once this
+// scan has stored the ones it decodes itself, so a thread holding a claim never
+// waits and two scans never decode the same row group of a variable at once.
+static void StataDtaReadSharedRows(const StataDtaBindData &bind_data, StataDtaGlobalState &gstate,
+                                   StataDtaFileScan &scan, StataDtaLocalState &lstate, idx_t count,
+                                   DataChunk &output) {
+	auto &shared = *scan.shared;
+	auto &path = bind_data.files[scan.file];
+	auto &column_ids = gstate.column_ids;
+	lstate.cached.assign(column_ids.size(), false);
+	lstate.missed.assign(column_ids.size(), false);
+	std::vector<bool> claimed(column_ids.size(), false);
+	std::vector<bool> waiting(column_ids.size(), false);
+	auto skip = lstate.cached;
+	try {
+		for (idx_t i = 0; i < column_ids.size(); i++) {
+			if (column_ids[i] >= bind_data.variable_count) {
+				continue;
+			}
+			// Deferred variables are decoded only for matching rows, so none are claimed for them
+			bool deferred = !gstate.deferred.empty() && gstate.deferred[i];
+			auto found = shared.Fetch(path, scan.shared_scan, column_ids[i], lstate.row_start, count, output.data[i],
+			                          !deferred);
+			if (found == StataSharedScans::FetchResult::FOUND) {
+				lstate.cached[i] = true;
+				skip[i] = true;
+			} else if (found == StataSharedScans::FetchResult::WAIT) {
+				waiting[i] = true;
+				skip[i] = true;
+			} else if (deferred) {
+				lstate.missed[i] = true;
+				skip[i] = true;
+				lstate.late = true;
+			} else {
+				claimed[i] = true;
+			}
+		}
+		lstate.cursor->ReadRows(lstate.row_start, count, output, &skip);
+		for (idx_t i = 0; i < column_ids.size(); i++) {
+			if (claimed[i]) {
+				shared.Store(path, scan.shared_scan, column_ids[i], lstate.row_start, count, output.data[i]);
+				claimed[i] = false;
+			}
+		}
+	} catch (...) {
+		for (idx_t i = 0; i < column_ids.size(); i++) {
+			if (claimed[i]) {
+				shared.Abandon(path, column_ids[i], lstate.row_start);
+			}
+		}
+		throw;
+	}
+	lstate.deferred = &lstate.missed;
+
+	// Row groups the other scan did not keep are decoded here after all
+	bool missing = false;
+	for (idx_t i = 0; i < column_ids.size(); i++) {
+		if (waiting[i]) {
+			lstate.cached[i] = shared.Wait(path, scan.shared_scan, column_ids[i], lstate.row_start, count,
+			                               output.data[i]);
+			skip[i] = lstate.cached[i];
+			missing = missing || !lstate.cached[i];
+		} else {
+			skip[i] = true;
+		}
+	}
+	if (missing) {
+		lstate.cursor->ReadRows(lstate.row_start, count, output, &skip);
+	}
+}
+
+// Whether every row after the chunk fails a dynamic upper bound on the file's sort
+// key, e.g. ORDER BY key LIMIT k once k smaller keys have been seen. Checked on the
+// chunk's last row: the filter needs the sort key, so it is already decoded.
+// Missing values sort last and fail every bound.
+static bool StataDtaPastDynamicBound(const StataDtaGlobalState &gstate, const StataDtaFileScan &scan,
+                                     DataChunk &output) {
+	if (scan.sort_column == DConstants::INVALID_INDEX || scan.use_rows || output.size() == 0) {
+		return false;
+	}
+	for (auto &dynamic : gstate.dynamic_filters) {
+		if (dynamic.column != scan.sort_column) {
+			continue;
+		}
+		auto bound = StataDynamicBound(*dynamic.data);
+		if (!bound || bound->filter_type != TableFilterType::CONSTANT_COMPARISON) {
+			continue;
+		}
+		auto &constant = bound->Cast<ConstantFilter>();
+		if (constant.comparison_type != ExpressionType::COMPARE_LESSTHAN &&
+		    constant.comparison_type != ExpressionType::COMPARE_LESSTHANOREQUALTO) {
+			continue;
+		}
+		auto value = output.data[dynamic.index].GetValue(output.size() - 1);
+		if (value.IsNull() || !constant.Compare(value)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Chunk of a scan that reads no variables: only rowid has values; partition
+// columns are set afterwards and other virtual columns are NULL
+static void StataDtaCountRows(const StataDtaGlobalState &gstate, idx_t first_row, idx_t count, DataChunk &output) {
+	for (idx_t i = 0; i < gstate.column_ids.size(); i++) {
+		if (gstate.column_ids[i] == COLUMN_IDENTIFIER_ROW_ID) {
+			auto row_ids = FlatVector::GetData<int64_t>(output.data[i]);
+			for (idx_t row = 0; row < count; row++) {
+				row_ids[row] = NumericCast<int64_t>(first_row + row);
+			}
+		} else {
+			output.data[i].SetVectorType(VectorType::CONSTANT_VECTOR);
+			ConstantVector::SetNull(output.data[i], true);
+		}
+	}
+	output.SetCardinality(count);
+}
+
+// When writing a copy: keeps the chunk of every variable for the copy, and
+// fills output with the projected columns
+static void StataDtaCopyRows(ClientContext &context, const StataDtaGlobalState &gstate, StataDtaLocalState &lstate,
+                             idx_t first_row, DataChunk &output) {
+	auto &variables = lstate.variables;
+	if (!lstate.copy_rows) {
+		lstate.copy_rows = make_uniq<ColumnDataCollection>(BufferAllocator::Get(context), variables.GetTypes());
+	}
+	lstate.copy_rows->Append(variables);
+	StataDtaCountRows(gstate, first_row, variables.size(), output);
+	for (idx_t i = 0; i < gstate.column_ids.size(); i++) {
+		if (gstate.column_ids[i] < variables.ColumnCount()) {
+			output.data[i].Reference(variables.data[gstate.column_ids[i]]);
+		}
+	}
+}
+
+// Reads the next chunk of rows, returns false when the scan is exhausted.
+// Threads take ranges of rows from the current file; a file that can only be
+// read front to back is read one chunk at a time under the lock.
+static bool StataDtaReadChunk(ClientContext &context, const StataDtaBindData &bind_data, StataDtaGlobalState &gstate,
+                              StataDtaLocalState &lstate, DataChunk &output) {
+	lstate.late = false;
+	if (lstate.row_start >= lstate.row_end) {
+		if (lstate.copy_rows) {
+			// The thread's batch is complete
+			gstate.copy->AddBatch(context, lstate.batch_index, std::move(lstate.copy_rows));
+		}
+		bool exhausted = false;
+		idx_t batches = 0;
+		{
+			lock_guard<mutex> guard(gstate.lock);
+			while (true) {
+				if (!gstate.current) {
+					exhausted = true;
+					batches = gstate.next_batch;
+					break;
+				}
+				auto &scan = *gstate.current;
+				if (!scan.parallel) {
+					if (scan.reader->HasMoreData()) {
+						lstate.scan = &scan;
+						lstate.batch_index = gstate.next_batch++;
+						if (gstate.copy) {
+							lstate.variables.Reset();
+							scan.reader->ReadDataChunk(lstate.variables, STANDARD_VECTOR_SIZE);
+							StataDtaCopyRows(context, gstate, lstate, scan.next_row, output);
+							scan.next_row += output.size();
+						} else {
+							scan.reader->ReadDataChunk(output, STANDARD_VECTOR_SIZE);
+						}
+						return true;
+					}
+				} else if (scan.next_row < scan.total_rows) {
+					lstate.row_start = scan.next_row;
+					lstate.row_end = MinValue<idx_t>(scan.total_rows, scan.next_row + STATA_ROWS_PER_TASK);
+					scan.next_row = lstate.row_end;
+					lstate.batch_index = gstate.next_batch++;
+					if (lstate.scan.get() != &scan) {
+						// Files whose rows are only counted are not opened
+						lstate.cursor = scan.reader ? scan.reader->OpenCursor() : nullptr;
+						lstate.scan = &scan;
+					}
+					break;
+				}
+				StataDtaNextFile(bind_data, gstate);
+			}
+		}
+		if (exhausted) {
+			if (gstate.copy) {
+				// Every batch is handed out; the last thread to hand in its rows finishes the copy
+				gstate.copy->SetBatchCount(context, batches);
+			}
+			return false;
+		}
+	}
+
+	auto &scan = *lstate.scan;
+	idx_t count = MinValue<idx_t>(STANDARD_VECTOR_SIZE, lstate.row_end - lstate.row_start);
+	lstate.chunk_start = lstate.row_start;
+	if (!lstate.cursor) {
+		StataDtaCountRows(gstate, lstate.row_start, count, output);
+	} else if (gstate.copy) {
+		lstate.variables.Reset();
+		lstate.cursor->ReadRows(lstate.row_start, count, lstate.variables);
+		StataDtaCopyRows(context, gstate, lstate, lstate.row_start, output);
+	} else if (!scan.fingerprint.empty() && !scan.use_rows && lstate.row_start % StataColumnCache::ROW_GROUP_SIZE == 0) {
+		StataDtaReadCachedRows(bind_data, gstate, scan, lstate, count, output);
+	} else if (scan.shared && !scan.use_rows && lstate.row_start % StataColumnCache::ROW_GROUP_SIZE == 0) {
+		StataDtaReadSharedRows(bind_data, gstate, scan, lstate, count, output);
+	} else {
+		// Only the variables the filters need are decoded here; see StataDtaDecodeDeferred
+		lstate.late = !gstate.deferred.empty();
+		lstate.deferred = &gstate.deferred;
+		auto skip = lstate.late ? &gstate.deferred : nullptr;
+		if (scan.use_rows) {
+			lstate.cursor->ReadSelectedRows(scan.rows.data() + lstate.row_start, count, output, skip);
+		} else {
+			lstate.cursor->ReadRows(lstate.row_start, count, output, skip);
+		}
+	}
+	lstate.row_start += count;
+	if (StataDtaPastDynamicBound(gstate, scan, output)) {
+		// Nothing after this chunk can pass; no thread needs to read further
+		lstate.row_start = lstate.row_end;
+		lock_guard<mutex> guard(gstate.lock);
+		scan.next_row = scan.total_rows;
+	}
+	return true;
+}
+
+// The reader leaves partition columns NULL; they are constant within a file
+static void StataDtaSetPartitions(const StataDtaBindData &bind_data, const StataDtaGlobalState &gstate,
+                                  const StataDtaFileScan &scan, DataChunk &output) {
+	if (bind_data.partition_values.empty()) {
+		return;
+	}
+	auto &values = bind_data.partition_values[scan.file];
+	for (idx_t i = 0; i < gstate.column_ids.size(); i++) {
+		auto column = gstate.column_ids[i];
+		if (column >= bind_data.variable_count && column < bind_data.types.size()) {
+			output.data[i].Reference(values[column - bind_data.variable_count]);
+		}
+	}
+}
+
+// Decodes the deferred variables of the count rows of the chunk that passed the
+// filters, and shrinks the other columns to those rows. Rows the filters drop are
+// never decoded beyond the variables the filters refer to.
+static void StataDtaDecodeDeferred(StataDtaLocalState &lstate, idx_t count, DataChunk &output) {
+	auto &scan = *lstate.scan;
+	auto &deferred = *lstate.deferred;
+	auto rows = scan.use_rows ? scan.rows.data() + lstate.chunk_start : nullptr;
+	if (count == output.size()) {
+		lstate.cursor->DecodeSkipped(lstate.chunk_start, rows, nullptr, count, output, deferred);
+		return;
+	}
+	for (idx_t i = 0; i < output.ColumnCount(); i++) {
+		if (!deferred[i]) {
+			output.data[i].Slice(lstate.sel, count);
+		}
+	}
+	lstate.cursor->DecodeSkipped(lstate.chunk_start, rows, &lstate.sel, count, output, deferred);
+}
+
+// Rebuilds the thread's filter executor when a dynamic filter got a new bound, so
+// every chunk is checked against the latest one
+static void StataDtaRefreshFilter(ClientContext &context, const StataDtaBindData &bind_data,
+                                  const StataDtaGlobalState &gstate, StataDtaLocalState &lstate) {
+	if (gstate.dynamic_filters.empty()) {
+		return;
+	}
+	lstate.dynamic_bounds.resize(gstate.dynamic_filters.size());
+	bool changed = false;
+	for (idx_t i = 0; i < gstate.dynamic_filters.size(); i++) {
+		auto bound = StataDynamicBound(*gstate.dynamic_filters[i].data);
+		if (bound && (!lstate.dynamic_bounds[i] || !lstate.dynamic_bounds[i]->Equals(*bound))) {
+			lstate.dynamic_bounds[i] = std::move(bound);
+			changed = true;
+		}
+	}
+	if (!changed) {
+		return;
+	}
+	auto conjunction = make_uniq<BoundConjunctionExpression>(ExpressionType::CONJUNCTION_AND);
+	conjunction->children.push_back(gstate.filter->Copy());
+	for (idx_t i = 0; i < gstate.dynamic_filters.size(); i++) {
+		if (lstate.dynamic_bounds[i]) {
+			auto &dynamic = gstate.dynamic_filters[i];
+			BoundReferenceExpression reference(bind_data.types[dynamic.column], dynamic.index);
+			conjunction->children.push_back(lstate.dynamic_bounds[i]->ToExpression(reference));
+		}
+	}
+	lstate.dynamic_filter = std::move(conjunction);
+	lstate.filter = make_uniq<ExpressionExecutor>(context, *lstate.dynamic_filter);
+}
+
 static void StataDtaFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
-	auto &data = data_p.bind_data->Cast<StataDtaBindData>();
-	
-	if (!data.reader->HasMoreData()) {
-		return; // No more data
+	auto &bind_data = data_p.bind_data->Cast<StataDtaBindData>();
+	auto &gstate = data_p.global_state->Cast<StataDtaGlobalState>();
+	auto &lstate = data_p.local_state->Cast<StataDtaLocalState>();
+
+	// Pushed-down filters are not re-applied by DuckDB; an empty chunk ends the
+	// scan, so keep reading until some row matches
+	while (StataDtaReadChunk(context, bind_data, gstate, lstate, output)) {
+		StataDtaSetPartitions(bind_data, gstate, *lstate.scan, output);
+		if (!lstate.filter) {
+			return;
+		}
+		StataDtaRefreshFilter(context, bind_data, gstate, lstate);
+		idx_t count = lstate.filter->SelectExpression(output, lstate.sel);
+		if (lstate.late && count > 0) {
+			StataDtaDecodeDeferred(lstate, count, output);
+			return;
+		}
+		if (count == output.size()) {
+			return;
+		}
+		if (count > 0) {
+			output.Slice(lstate.sel, count);
+			return;
+		}
+		output.Reset();
 	}
-	
-	auto chunk = data.reader->ReadChunk(STANDARD_VECTOR_SIZE);
-	if (!chunk || chunk->size() == 0) {
+}
+
+// COPY ... TO 'file.dta' (FORMAT stata)
+struct StataCopyBindData : public TableFunctionData {
+	std::vector<StataWriterColumn> columns;
+	uint16_t format_version = 118;
+	bool compress = false;
+	// Output columns of the query's ORDER BY, see StataCopySortColumns
+	std::vector<idx_t> sort_columns;
+	// strL contents kept for deduplication by all files of the COPY (one per
+	// PARTITION_BY value): an eighth of the memory limit
+	shared_ptr<StataStrLBudget> strl_budget;
+};
+
+struct StataCopyGlobalState : public GlobalFunctionData {
+	mutex lock;
+	unique_ptr<StataWriter> writer;
+};
+
+struct StataCopyLocalState : public LocalFunctionData {
+	StataRowBlock block;
+};
+
+struct StataCopyBatch : public PreparedBatchData {
+	StataRowBlock block;
+};
+
+// Leading ascending ORDER BY keys of the exported query that are plain output
+// columns. The writer only records them in <sortlist> if the rows confirm the order.
+static std::vector<idx_t> StataCopySortColumns(const CopyInfo &info, const vector<string> &names) {
+	std::vector<idx_t> result;
+	if (!info.select_statement) {
+		return result;
+	}
+	for (auto &modifier : info.select_statement->modifiers) {
+		if (modifier->type != ResultModifierType::ORDER_MODIFIER) {
+			continue;
+		}
+		for (auto &order : modifier->Cast<OrderModifier>().orders) {
+			if (order.type == OrderType::DESCENDING ||
+			    order.expression->GetExpressionClass() != ExpressionClass::COLUMN_REF) {
+				break;
+			}
+			auto &column_name = order.expression->Cast<ColumnRefExpression>().GetColumnName();
+			idx_t col = 0;
+			while (col < names.size() && !StringUtil::CIEquals(names[col], column_name)) {
+				col++;
+			}
+			if (col == names.size()) {
+				break;
+			}
+			result.push_back(col);
+		}
+		break;
+	}
+	return result;
+}
+
+static unique_ptr<FunctionData> StataCopyBind(ClientContext &context, CopyFunctionBindInput &input,
+                                              const vector<string> &names, const vector<LogicalType> &sql_types) {
+	auto result = make_uniq<StataCopyBindData>();
+	for (auto &option : input.info.options) {
+		auto loption = StringUtil::Lower(option.first);
+		if (loption == "compress" && option.second.empty()) {
+			// Bare COMPRESS, like HEADER for CSV
+			result->compress = true;
+			continue;
+		}
+		if (option.second.size() != 1) {
+			throw BinderException("Stata export option \"%s\" requires a single argument", option.first);
+		}
+		if (loption == "version") {
+			auto version = option.second[0].GetValue<int64_t>();
+			if (version != 117 && version != 118 && version != 119) {
+				throw BinderException("Unsupported Stata file version for writing: %d. Supported versions: 117-119",
+				                      version);
+			}
+			result->format_version = static_cast<uint16_t>(version);
+		} else if (loption == "compress") {
+			result->compress = BooleanValue::Get(option.second[0].DefaultCastAs(LogicalType::BOOLEAN));
+		} else {
+			throw NotImplementedException("Unrecognized option for Stata export: %s", option.first);
+		}
+	}
+	result->columns = StataWriter::BindColumns(names, sql_types, result->format_version, result->compress);
+	result->sort_columns = StataCopySortColumns(input.info, names);
+	result->strl_budget =
+	    make_shared_ptr<StataStrLBudget>(BufferManager::GetBufferManager(context).GetMaxMemory() / 8);
+	return std::move(result);
+}
+
+static unique_ptr<GlobalFunctionData> StataCopyInitGlobal(ClientContext &context, FunctionData &bind_data_p,
+                                                          const string &file_path) {
+	auto &bind_data = bind_data_p.Cast<StataCopyBindData>();
+	auto result = make_uniq<StataCopyGlobalState>();
+	result->writer = make_uniq<StataWriter>(file_path, bind_data.columns, bind_data.format_version, bind_data.compress,
+	                                        bind_data.sort_columns, bind_data.strl_budget);
+	return std::move(result);
+}
+
+static unique_ptr<LocalFunctionData> StataCopyInitLocal(ExecutionContext &context, FunctionData &bind_data) {
+	return make_uniq<StataCopyLocalState>();
+}
+
+// Sink path, used when the source has no batch indexes: each thread encodes into its
+// own block and appends it once it is large enough
+static void StataCopySink(ExecutionContext &context, FunctionData &bind_data, GlobalFunctionData &gstate_p,
+                          LocalFunctionData &lstate_p, DataChunk &input) {
+	auto &gstate = gstate_p.Cast<StataCopyGlobalState>();
+	auto &lstate = lstate_p.Cast<StataCopyLocalState>();
+	gstate.writer->EncodeChunk(input, lstate.block);
+	if (lstate.block.count >= STATA_ROWS_PER_TASK) {
+		lock_guard<mutex> guard(gstate.lock);
+		gstate.writer->WriteBlock(lstate.block);
+		lstate.block.Clear();
+	}
+}
+
+static void StataCopyCombine(ExecutionContext &context, FunctionData &bind_data, GlobalFunctionData &gstate_p,
+                             LocalFunctionData &lstate_p) {
+	auto &gstate = gstate_p.Cast<StataCopyGlobalState>();
+	auto &lstate = lstate_p.Cast<StataCopyLocalState>();
+	lock_guard<mutex> guard(gstate.lock);
+	gstate.writer->WriteBlock(lstate.block);
+	lstate.block.Clear();
+}
+
+static void StataCopyFinalize(ClientContext &context, FunctionData &bind_data, GlobalFunctionData &gstate_p) {
+	auto &gstate = gstate_p.Cast<StataCopyGlobalState>();
+	gstate.writer->Finish();
+}
+
+static CopyFunctionExecutionMode StataCopyExecutionMode(bool preserve_insertion_order, bool supports_batch_index) {
+	if (!preserve_insertion_order) {
+		return CopyFunctionExecutionMode::PARALLEL_COPY_TO_FILE;
+	}
+	if (supports_batch_index) {
+		return CopyFunctionExecutionMode::BATCH_COPY_TO_FILE;
+	}
+	return CopyFunctionExecutionMode::REGULAR_COPY_TO_FILE;
+}
+
+// Batch path: batches are encoded into row blocks in parallel and flushed in order
+static unique_ptr<PreparedBatchData> StataCopyPrepareBatch(ClientContext &context, FunctionData &bind_data,
+                                                           GlobalFunctionData &gstate_p,
+                                                           unique_ptr<ColumnDataCollection> collection) {
+	auto &gstate = gstate_p.Cast<StataCopyGlobalState>();
+	auto result = make_uniq<StataCopyBatch>();
+	for (auto &chunk : collection->Chunks()) {
+		gstate.writer->EncodeChunk(chunk, result->block);
+	}
+	return std::move(result);
+}
+
+static void StataCopyFlushBatch(ClientContext &context, FunctionData &bind_data, GlobalFunctionData &gstate_p,
+                                PreparedBatchData &batch_p) {
+	auto &gstate = gstate_p.Cast<StataCopyGlobalState>();
+	auto &batch = batch_p.Cast<StataCopyBatch>();
+	lock_guard<mutex> guard(gstate.lock);
+	gstate.writer->WriteBlock(batch.block);
+}
+
+static idx_t StataCopyDesiredBatchSize(ClientContext &context, FunctionData &bind_data) {
+	return STATA_ROWS_PER_TASK;
+}
+
+// Metadata table functions: stata_dta_header, stata_dta_variables, stata_dta_labels
+// and stata_dta_characteristics.
+// Each file is opened separately and read only as far as the requested sections,
+// with files spread over threads. Headers and variables come from the schema
+// cache instead when the stata_schema_cache setting names one.
+typedef void (*stata_metadata_rows_t)(const std::string &filename, optional_ptr<StataSchemaCache> cache,
+                                      vector<vector<Value>> &rows);
+
+struct StataMetadataBindData : public TableFunctionData {
+	vector<string> files;
+	shared_ptr<StataSchemaCache> cache;
+};
+
+struct StataMetadataGlobalState : public GlobalTableFunctionState {
+	atomic<idx_t> next_file {0};
+	idx_t max_threads = 1;
+
+	idx_t MaxThreads() const override {
+		return max_threads;
+	}
+};
+
+struct StataMetadataLocalState : public LocalTableFunctionState {
+	// Rows of the file being emitted
+	vector<vector<Value>> rows;
+	idx_t offset = 0;
+};
+
+static unique_ptr<FunctionData> StataMetadataBindFiles(ClientContext &context, TableFunctionBindInput &input,
+                                                       const string &function) {
+	auto result = make_uniq<StataMetadataBindData>();
+	result->files = StataExpandFiles(context, input.inputs[0], function);
+	result->cache = StataGetSchemaCache(context);
+	return std::move(result);
+}
+
+static unique_ptr<GlobalTableFunctionState> StataMetadataInitGlobal(ClientContext &context,
+                                                                    TableFunctionInitInput &input) {
+	auto &bind_data = input.bind_data->Cast<StataMetadataBindData>();
+	auto result = make_uniq<StataMetadataGlobalState>();
+	result->max_threads = MaxValue<idx_t>(1, bind_data.files.size());
+	return std::move(result);
+}
+
+static unique_ptr<LocalTableFunctionState> StataMetadataInitLocal(ExecutionContext &context,
+                                                                  TableFunctionInitInput &input,
+                                                                  GlobalTableFunctionState *global_state) {
+	return make_uniq<StataMetadataLocalState>();
+}
+
+template <stata_metadata_rows_t ROWS>
+static void StataMetadataFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
+	auto &bind_data = data_p.bind_data->Cast<StataMetadataBindData>();
+	auto &gstate = data_p.global_state->Cast<StataMetadataGlobalState>();
+	auto &lstate = data_p.local_state->Cast<StataMetadataLocalState>();
+
+	idx_t count = 0;
+	while (count < STANDARD_VECTOR_SIZE) {
+		if (lstate.offset >= lstate.rows.size()) {
+			idx_t file = gstate.next_file++;
+			if (file >= bind_data.files.size()) {
+				break;
+			}
+			lstate.rows.clear();
+			lstate.offset = 0;
+			ROWS(bind_data.files[file], bind_data.cache.get(), lstate.rows);
+			continue;
+		}
+		auto &row = lstate.rows[lstate.offset++];
+		for (idx_t col = 0; col < row.size(); col++) {
+			output.SetValue(col, count, row[col]);
+		}
+		count++;
+	}
+	output.SetCardinality(count);
+}
+
+static unique_ptr<StataReader> StataOpenForMetadata(const std::string &filename) {
+	auto reader = make_uniq<StataReader>(filename);
+	if (!reader->Open()) {
+		throw IOException("Cannot open Stata file: " + filename);
+	}
+	return reader;
+}
+
+// Header and variables of a file; formats and labels only with_metadata
+static shared_ptr<const StataSchema> StataSchemaForMetadata(const std::string &filename,
+                                                            optional_ptr<StataSchemaCache> cache, bool with_metadata) {
+	auto schema = cache ? cache->Lookup(filename) : nullptr;
+	if (schema) {
+		return schema;
+	}
+	auto reader = StataOpenForMetadata(filename);
+	if (with_metadata) {
+		reader->LoadMetadata();
+	}
+	auto result = make_shared_ptr<StataSchema>();
+	result->header = reader->GetHeader();
+	result->variables = reader->GetVariables();
+	return result;
+}
+
+static Value StataOptionalString(const std::string &value) {
+	return value.empty() ? Value(LogicalType::VARCHAR) : Value(value);
+}
+
+static std::string StataTypeName(const StataVariable &var) {
+	switch (var.type) {
+	case StataDataType::BYTE:
+		return "byte";
+	case StataDataType::INT:
+		return "int";
+	case StataDataType::LONG:
+		return "long";
+	case StataDataType::FLOAT:
+		return "float";
+	case StataDataType::DOUBLE:
+		return "double";
+	case StataDataType::STRL:
+		return "strL";
+	default:
+		return "str" + std::to_string(var.str_len);
+	}
+}
+
+// Bytes the variable takes in each row
+static int32_t StataTypeWidth(const StataVariable &var) {
+	switch (var.type) {
+	case StataDataType::BYTE:
+		return 1;
+	case StataDataType::INT:
+		return 2;
+	case StataDataType::LONG:
+	case StataDataType::FLOAT:
+		return 4;
+	case StataDataType::DOUBLE:
+	case StataDataType::STRL:
+		return 8;
+	default:
+		return var.str_len;
+	}
+}
+
+static unique_ptr<FunctionData> StataHeaderBind(ClientContext &context, TableFunctionBindInput &input,
+                                                vector<LogicalType> &return_types, vector<string> &names) {
+	names = {"filename", "format_version", "byte_order", "nvar", "nobs", "data_label", "timestamp", "sorted_by"};
+	return_types = {LogicalType::VARCHAR, LogicalType::INTEGER, LogicalType::VARCHAR,
+	                LogicalType::BIGINT,  LogicalType::BIGINT,  LogicalType::VARCHAR,
+	                LogicalType::VARCHAR, LogicalType::LIST(LogicalType::VARCHAR)};
+	return StataMetadataBindFiles(context, input, "stata_dta_header");
+}
+
+static void StataHeaderRows(const std::string &filename, optional_ptr<StataSchemaCache> cache,
+                            vector<vector<Value>> &rows) {
+	auto schema = StataSchemaForMetadata(filename, cache, false);
+	auto &header = schema->header;
+	vector<Value> sorted_by;
+	for (auto column : header.sort_order) {
+		sorted_by.emplace_back(schema->variables[column].name);
+	}
+	rows.push_back({Value(filename), Value::INTEGER(header.format_version),
+	                Value(header.is_big_endian ? "MSF" : "LSF"), Value::BIGINT(NumericCast<int64_t>(header.nvar)),
+	                Value::BIGINT(NumericCast<int64_t>(header.nobs)), StataOptionalString(header.data_label),
+	                StataOptionalString(header.timestamp), Value::LIST(LogicalType::VARCHAR, std::move(sorted_by))});
+}
+
+static unique_ptr<FunctionData> StataVariablesBind(ClientContext &context, TableFunctionBindInput &input,
+                                                   vector<LogicalType> &return_types, vector<string> &names) {
+	names = {"filename", "position", "name", "type", "width", "format", "label", "value_label"};
+	return_types = {LogicalType::VARCHAR, LogicalType::INTEGER, LogicalType::VARCHAR, LogicalType::VARCHAR,
+	                LogicalType::INTEGER, LogicalType::VARCHAR, LogicalType::VARCHAR, LogicalType::VARCHAR};
+	return StataMetadataBindFiles(context, input, "stata_dta_variables");
+}
+
+static void StataVariablesRows(const std::string &filename, optional_ptr<StataSchemaCache> cache,
+                               vector<vector<Value>> &rows) {
+	auto schema = StataSchemaForMetadata(filename, cache, true);
+	auto &variables = schema->variables;
+	for (idx_t i = 0; i < variables.size(); i++) {
+		auto &var = variables[i];
+		rows.push_back({Value(filename), Value::INTEGER(NumericCast<int32_t>(i + 1)), Value(var.name),
+		                Value(StataTypeName(var)), Value::INTEGER(StataTypeWidth(var)),
+		                StataOptionalString(var.format), StataOptionalString(var.label),
+		                StataOptionalString(var.value_label_name)});
+	}
+}
+
+static unique_ptr<FunctionData> StataLabelsBind(ClientContext &context, TableFunctionBindInput &input,
+                                                vector<LogicalType> &return_types, vector<string> &names) {
+	names = {"filename", "label_name", "value", "label"};
+	return_types = {LogicalType::VARCHAR, LogicalType::VARCHAR, LogicalType::INTEGER, LogicalType::VARCHAR};
+	return StataMetadataBindFiles(context, input, "stata_dta_labels");
+}
+
+static void StataLabelsRows(const std::string &filename, optional_ptr<StataSchemaCache> cache,
+                            vector<vector<Value>> &rows) {
+	auto reader = StataOpenForMetadata(filename);
+	for (auto &table : reader->LoadValueLabels()) {
+		for (auto &entry : table.second) {
+			rows.push_back({Value(filename), Value(table.first), Value::INTEGER(entry.first), Value(entry.second)});
+		}
+	}
+}
+
+static unique_ptr<FunctionData> StataCharacteristicsBind(ClientContext &context, TableFunctionBindInput &input,
+                                                         vector<LogicalType> &return_types, vector<string> &names) {
+	names = {"filename", "variable", "name", "contents"};
+	return_types = {LogicalType::VARCHAR, LogicalType::VARCHAR, LogicalType::VARCHAR, LogicalType::VARCHAR};
+	return StataMetadataBindFiles(context, input, "stata_dta_characteristics");
+}
+
+static void StataCharacteristicsRows(const std::string &filename, optional_ptr<StataSchemaCache> cache,
+                                     vector<vector<Value>> &rows) {
+	auto reader = StataOpenForMetadata(filename);
+	for (auto &characteristic : reader->LoadCharacteristics()) {
+		rows.push_back({Value(filename), Value(characteristic.variable), Value(characteristic.name),
+		                Value(characteristic.contents)});
+	}
+}
+
+// stata_dta_build_key_index(path, column)
+struct StataKeyIndexBindData : public TableFunctionData {
+	std::string filename;
+	std::string variable;
+};
+
+struct StataKeyIndexState : public GlobalTableFunctionState {
+	bool done = false;
+};
+
+static unique_ptr<FunctionData> StataKeyIndexBind(ClientContext &context, TableFunctionBindInput &input,
+                                                  vector<LogicalType> &return_types, vector<string> &names) {
+	if (input.inputs[0].IsNull() || input.inputs[1].IsNull()) {
+		throw InvalidInputException("stata_dta_build_key_index requires a filename and a column name");
+	}
+	auto result = make_uniq<StataKeyIndexBindData>();
+	result->filename = StringValue::Get(input.inputs[0]);
+	result->variable = StringValue::Get(input.inputs[1]);
+	return_types = {LogicalType::VARCHAR, LogicalType::BIGINT};
+	names = {"index_file", "indexed_rows"};
+	return std::move(result);
+}
+
+static unique_ptr<GlobalTableFunctionState> StataKeyIndexInit(ClientContext &context, TableFunctionInitInput &input) {
+	return make_uniq<StataKeyIndexState>();
+}
+
+static void StataKeyIndexFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
+	auto &bind_data = data_p.bind_data->Cast<StataKeyIndexBindData>();
+	auto &state = data_p.global_state->Cast<StataKeyIndexState>();
+	if (state.done) {
 		return;
 	}
-	
-	// Copy data to output
-	output.SetCardinality(chunk->size());
-	for (idx_t col_idx = 0; col_idx < chunk->ColumnCount(); col_idx++) {
-		output.data[col_idx].Reference(chunk->data[col_idx]);
+	state.done = true;
+	idx_t rows = StataKeyIndex::Build(bind_data.filename, bind_data.variable);
+	output.SetValue(0, 0, Value(StataKeyIndex::IndexPath(bind_data.filename, bind_data.variable)));
+	output.SetValue(1, 0, Value::BIGINT(NumericCast<int64_t>(rows)));
+	output.SetCardinality(1);
+}
+
+// stata_dta_column_cache()
+struct StataColumnCacheState : public GlobalTableFunctionState {
+	std::vector<StataColumnCache::EntryInfo> entries;
+	idx_t offset = 0;
+};
+
+static unique_ptr<FunctionData> StataColumnCacheBind(ClientContext &context, TableFunctionBindInput &input,
+                                                     vector<LogicalType> &return_types, vector<string> &names) {
+	return_types = {LogicalType::VARCHAR, LogicalType::VARCHAR, LogicalType::BIGINT, LogicalType::BIGINT,
+	                LogicalType::BIGINT};
+	names = {"filename", "variable", "first_row", "rows", "bytes"};
+	return make_uniq<TableFunctionData>();
+}
+
+static unique_ptr<GlobalTableFunctionState> StataColumnCacheInit(ClientContext &context,
+                                                                 TableFunctionInitInput &input) {
+	auto result = make_uniq<StataColumnCacheState>();
+	auto cache = StataColumnCache::Get(context);
+	if (cache) {
+		result->entries = cache->GetEntries();
+	}
+	return std::move(result);
+}
+
+static void StataColumnCacheFunction(ClientContext &context, TableFunctionInput &data_p, DataChunk &output) {
+	auto &state = data_p.global_state->Cast<StataColumnCacheState>();
+	idx_t count = 0;
+	while (state.offset < state.entries.size() && count < STANDARD_VECTOR_SIZE) {
+		auto &entry = state.entries[state.offset++];
+		output.SetValue(0, count, Value(entry.filename));
+		output.SetValue(1, count, Value(entry.variable));
+		output.SetValue(2, count, Value::BIGINT(NumericCast<int64_t>(entry.first_row)));
+		output.SetValue(3, count, Value::BIGINT(NumericCast<int64_t>(entry.rows)));
+		output.SetValue(4, count, Value::BIGINT(NumericCast<int64_t>(entry.bytes)));
+		count++;
+	}
+	output.SetCardinality(count);
+}
+
+// Rewrites FROM 'file.dta' (also .dta.gz and .dta.zst) to read_stata_dta('file.dta'),
+// so the scan keeps its projection, filter and cardinality pushdown
+static unique_ptr<TableRef> StataReplacementScan(ClientContext &context, ReplacementScanInput &input,
+                                                 optional_ptr<ReplacementScanData> data) {
+	auto table_name = ReplacementScan::GetFullPath(input);
+	if (!ReplacementScan::CanReplace(table_name, {"dta"})) {
+		return nullptr;
+	}
+	auto table_function = make_uniq<TableFunctionRef>();
+	vector<unique_ptr<ParsedExpression>> children;
+	children.push_back(make_uniq<ConstantExpression>(Value(table_name)));
+	table_function->function = make_uniq<FunctionExpression>("read_stata_dta", std::move(children));
+	if (!FileSystem::HasGlob(table_name)) {
+		auto &fs = FileSystem::GetFileSystem(context);
+		table_function->alias = fs.ExtractBaseName(table_name);
 	}
+	return std::move(table_function);
 }
 
 // Placeholder function - will show extension info
@@ -85,11 +2008,96 @@ inline void StataDtaInfoFun(DataChunk &args, ExpressionState &state, Vector &res
 	});
 }
 
+// Tasks are handed out in file and row order, so their numbers let order-preserving
+// sinks (CREATE TABLE AS, COPY TO, INSERT) put rows back in file order while all
+// threads decode
+static OperatorPartitionData StataDtaGetPartitionData(ClientContext &context, TableFunctionGetPartitionInput &input) {
+	if (input.partition_info.RequiresPartitionColumns()) {
+		throw InternalException("read_stata_dta does not support partition columns");
+	}
+	auto &lstate = input.local_state->Cast<StataDtaLocalState>();
+	return OperatorPartitionData(lstate.batch_index);
+}
+
+TableFunction GetStataReadFunction() {
+	TableFunction stata_read_function("read_stata_dta", {LogicalType::VARCHAR}, StataDtaFunction, StataDtaBind,
+	                                  StataDtaInitGlobal, StataDtaInitLocal);
+	stata_read_function.named_parameters["columns"] = LogicalType::LIST(LogicalType::VARCHAR);
+	stata_read_function.named_parameters["hive_partitioning"] = LogicalType::BOOLEAN;
+	stata_read_function.named_parameters["cache_dir"] = LogicalType::VARCHAR;
+	stata_read_function.bind_replace = StataDtaBindReplace;
+	stata_read_function.projection_pushdown = true;
+	stata_read_function.filter_pushdown = true;
+	stata_read_function.cardinality = StataDtaCardinality;
+	stata_read_function.statistics = StataDtaStatistics;
+	stata_read_function.get_partition_data = StataDtaGetPartitionData;
+	return stata_read_function;
+}
+
 static void LoadInternal(DatabaseInstance &instance) {
 	// Register Stata DTA table reading function
-	TableFunction stata_read_function("read_stata_dta", {LogicalType::VARCHAR}, StataDtaFunction, StataDtaBind);
-	stata_read_function.named_parameters["columns"] = LogicalType::LIST(LogicalType::VARCHAR);
-	ExtensionUtil::RegisterFunction(instance, stata_read_function);
+	ExtensionUtil::RegisterFunction(instance, GetStataReadFunction());
+
+	// Register key index builder for point lookups on unsorted files
+	TableFunction stata_key_index_function("stata_dta_build_key_index", {LogicalType::VARCHAR, LogicalType::VARCHAR},
+	                                       StataKeyIndexFunction, StataKeyIndexBind, StataKeyIndexInit);
+	ExtensionUtil::RegisterFunction(instance, stata_key_index_function);
+
+	// Register the column cache listing
+	TableFunction stata_column_cache_function("stata_dta_column_cache", {}, StataColumnCacheFunction,
+	                                          StataColumnCacheBind, StataColumnCacheInit);
+	ExtensionUtil::RegisterFunction(instance, stata_column_cache_function);
+
+	// Register metadata functions; each takes a path or a glob
+	TableFunction stata_header_function("stata_dta_header", {LogicalType::VARCHAR},
+	                                    StataMetadataFunction<StataHeaderRows>, StataHeaderBind,
+	                                    StataMetadataInitGlobal, StataMetadataInitLocal);
+	ExtensionUtil::RegisterFunction(instance, stata_header_function);
+	TableFunction stata_variables_function("stata_dta_variables", {LogicalType::VARCHAR},
+	                                       StataMetadataFunction<StataVariablesRows>, StataVariablesBind,
+	                                       StataMetadataInitGlobal, StataMetadataInitLocal);
+	ExtensionUtil::RegisterFunction(instance, stata_variables_function);
+	TableFunction stata_labels_function("stata_dta_labels", {LogicalType::VARCHAR},
+	                                    StataMetadataFunction<StataLabelsRows>, StataLabelsBind,
+	                                    StataMetadataInitGlobal, StataMetadataInitLocal);
+	ExtensionUtil::RegisterFunction(instance, stata_labels_function);
+	TableFunction stata_characteristics_function("stata_dta_characteristics", {LogicalType::VARCHAR},
+	                                             StataMetadataFunction<StataCharacteristicsRows>,
+	                                             StataCharacteristicsBind, StataMetadataInitGlobal,
+	                                             StataMetadataInitLocal);
+	ExtensionUtil::RegisterFunction(instance, stata_characteristics_function);
+
+	auto &config = DBConfig::GetConfig(instance);
+	config.AddExtensionOption("stata_schema_cache",
+	                          "File caching the headers and variables of Stata files by path, size and modification "
+	                          "time, consulted before opening them",
+	                          LogicalType::VARCHAR, Value(""));
+	config.AddExtensionOption("stata_cache_dir",
+	                          "Directory of Parquet copies of Stata files, written on the first scan of each file and "
+	                          "read instead of it afterwards",
+	                          LogicalType::VARCHAR, Value(""));
+	config.AddExtensionOption("stata_column_cache_size",
+	                          "Memory kept for decoded row groups of Stata files, shared by all queries and evicted "
+	                          "least recently used first; 0 disables the cache",
+	                          LogicalType::VARCHAR, Value("0MB"));
+	config.replacement_scans.emplace_back(StataReplacementScan);
+	// ATTACH 'directory' (TYPE stata)
+	config.storage_extensions["stata"] = make_uniq<StataStorageExtension>();
+
+	// Register COPY ... (FORMAT stata)
+	CopyFunction stata_copy_function("stata");
+	stata_copy_function.copy_to_bind = StataCopyBind;
+	stata_copy_function.copy_to_initialize_global = StataCopyInitGlobal;
+	stata_copy_function.copy_to_initialize_local = StataCopyInitLocal;
+	stata_copy_function.copy_to_sink = StataCopySink;
+	stata_copy_function.copy_to_combine = StataCopyCombine;
+	stata_copy_function.copy_to_finalize = StataCopyFinalize;
+	stata_copy_function.execution_mode = StataCopyExecutionMode;
+	stata_copy_function.prepare_batch = StataCopyPrepareBatch;
+	stata_copy_function.flush_batch = StataCopyFlushBatch;
+	stata_copy_function.desired_batch_size = StataCopyDesiredBatchSize;
+	stata_copy_function.extension = "dta";
+	ExtensionUtil::RegisterFunction(instance, stata_copy_function);
 
 	// Register extension info function
 	auto stata_info_function = ScalarFunction("stata_dta_info", {LogicalType::VARCHAR},
@@ -0,0 +1,320 @@
+#include "stata_key_index.hpp"
+#include "stata_parser.hpp"
+#include "stata_stream.hpp"
+#include "duckdb/common/exception.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+
+namespace duckdb {
+
+static constexpr char STATA_KEY_INDEX_MAGIC[8] = {'S', 'T', 'A', 'T', 'A', 'K', 'I', 'X'};
+static constexpr uint32_t STATA_KEY_INDEX_VERSION = 2;
+// Bytes at the start of the data file whose hash is stamped in the index
+static constexpr size_t STATA_KEY_INDEX_SOURCE_BYTES = 4096;
+// Memory for building an index; the row buckets of larger files are spilled
+static constexpr uint64_t STATA_KEY_INDEX_BUILD_MEMORY = 256 * 1024 * 1024;
+// Row buckets read from the spill at a time
+static constexpr uint64_t STATA_KEY_INDEX_SPILL_BUFFER = 64 * 1024;
+
+std::string StataKeyIndex::IndexPath(const std::string& data_path, const std::string& variable) {
+    return data_path + "." + variable + ".keyidx";
+}
+
+uint64_t StataKeyIndex::HashKey(const Value& key) {
+    // FNV-1a over the key bytes, then a 64-bit finalizer. Numbers are hashed as
+    // doubles so a filter constant matches whatever Stata type stores the key.
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](const void* data, size_t size) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    };
+    if (key.type().id() == LogicalTypeId::VARCHAR) {
+        auto& str = StringValue::Get(key);
+        mix(str.data(), str.size());
+    } else {
+        double number = key.GetValue<double>();
+        if (number == 0) {
+            number = 0; // -0.0 and 0.0 are the same key
+        }
+        mix(&number, sizeof(number));
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Hash of the start of the data file, which holds its header and section map.
+// Together with size and modification time it tells whether the index is stale.
+static uint64_t StataSourceHeaderHash(const std::string& data_path) {
+    std::ifstream file(data_path, std::ios::binary);
+    std::vector<char> buffer(STATA_KEY_INDEX_SOURCE_BYTES);
+    file.read(buffer.data(), buffer.size());
+    auto size = static_cast<size_t>(file.gcount());
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ static_cast<uint8_t>(buffer[i])) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+idx_t StataKeyIndex::Build(const std::string& data_path, const std::string& variable) {
+    Header header;
+    std::memcpy(header.magic, STATA_KEY_INDEX_MAGIC, sizeof(header.magic));
+    header.version = STATA_KEY_INDEX_VERSION;
+    if (!StataFileStamp(data_path, header.source_size, header.source_mtime)) {
+        throw InvalidInputException("Key indexes can only be built for regular files: %s", data_path);
+    }
+    header.source_header_hash = StataSourceHeaderHash(data_path);
+
+    idx_t column = 0;
+    {
+        StataReader reader(data_path);
+        if (!reader.Open()) {
+            throw IOException("Cannot open Stata file: " + data_path);
+        }
+        const auto& variables = reader.GetVariables();
+        while (column < variables.size() && variables[column].name != variable) {
+            column++;
+        }
+        if (column == variables.size()) {
+            throw InvalidInputException("Stata file \"%s\" has no variable \"%s\"", data_path, variable);
+        }
+        header.nobs = reader.GetHeader().nobs;
+    }
+
+    // About two rows per bucket
+    header.bucket_count = 1;
+    while (header.bucket_count * 2 < header.nobs) {
+        header.bucket_count *= 2;
+    }
+    header.row_width = header.nobs > NumericLimits<uint32_t>::Maximum() ? 8 : 4;
+
+    // The bucket of every row, from a single pass over the data file. Missing keys
+    // never match a filter and get NO_BUCKET, so they are left out. The buckets
+    // are kept in memory if they fit, otherwise spilled next to the index, so the
+    // counting sort below rereads the spill instead of decoding the file again.
+    static constexpr uint64_t NO_BUCKET = ~uint64_t(0);
+    std::vector<uint64_t> row_buckets;
+    bool in_memory = header.nobs * sizeof(uint64_t) <= STATA_KEY_INDEX_BUILD_MEMORY / 4;
+    unique_ptr<StataTemporaryFile> spill;
+    uint64_t row_count = 0;
+    {
+        std::ofstream spill_out;
+        if (!in_memory) {
+            auto directory = std::filesystem::path(data_path).parent_path();
+            spill = make_uniq<StataTemporaryFile>(directory.empty() ? "." : directory.string());
+            spill_out.open(spill->GetPath(), std::ios::binary | std::ios::trunc);
+            if (!spill_out.is_open()) {
+                throw IOException("Cannot create key index: " + spill->GetPath());
+            }
+        }
+        StataReader reader(data_path);
+        if (!reader.Open()) {
+            throw IOException("Cannot open Stata file: " + data_path);
+        }
+        reader.SetProjection({column});
+        std::vector<uint64_t> buckets;
+        while (reader.HasMoreData()) {
+            auto chunk = reader.ReadChunk(STANDARD_VECTOR_SIZE);
+            auto& keys = chunk->data[0];
+            buckets.resize(chunk->size());
+            for (idx_t i = 0; i < chunk->size(); i++) {
+                auto key = keys.GetValue(i);
+                buckets[i] = key.IsNull() ? NO_BUCKET : HashKey(key) & (header.bucket_count - 1);
+            }
+            if (in_memory) {
+                row_buckets.insert(row_buckets.end(), buckets.begin(), buckets.end());
+            } else {
+                spill_out.write(reinterpret_cast<const char*>(buckets.data()), buckets.size() * sizeof(uint64_t));
+            }
+            row_count += buckets.size();
+        }
+        if (!in_memory) {
+            spill_out.close();
+            if (!spill_out) {
+                throw IOException("Failed to write key index: " + spill->GetPath());
+            }
+        }
+    }
+
+    // Calls callback(row, bucket) for every row whose key is not missing
+    auto for_each_row = [&](const std::function<void(uint64_t, uint64_t)>& callback) {
+        if (in_memory) {
+            for (uint64_t row = 0; row < row_buckets.size(); row++) {
+                if (row_buckets[row] != NO_BUCKET) {
+                    callback(row, row_buckets[row]);
+                }
+            }
+            return;
+        }
+        std::ifstream spill_in(spill->GetPath(), std::ios::binary);
+        std::vector<uint64_t> buffer(STATA_KEY_INDEX_SPILL_BUFFER);
+        uint64_t row = 0;
+        while (row < row_count) {
+            uint64_t count = MinValue<uint64_t>(buffer.size(), row_count - row);
+            spill_in.read(reinterpret_cast<char*>(buffer.data()), count * sizeof(uint64_t));
+            if (!spill_in) {
+                throw IOException("Failed to read key index spill: " + spill->GetPath());
+            }
+            for (uint64_t i = 0; i < count; i++, row++) {
+                if (buffer[i] != NO_BUCKET) {
+                    callback(row, buffer[i]);
+                }
+            }
+        }
+    };
+
+    // Written to a temporary name first so readers never see a partial index
+    auto path = IndexPath(data_path, variable);
+    auto temp_path = path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw IOException("Cannot create key index: " + temp_path);
+    }
+    uint64_t entries_start = sizeof(Header) + (header.bucket_count + 1) * sizeof(uint64_t);
+
+    // A counting sort of the row numbers by bucket, in bounded memory: buckets are
+    // taken a range at a time, and a range's row numbers one window at a time,
+    // each window placing the rows whose slot falls into it.
+    uint64_t buckets_per_pass =
+        MinValue<uint64_t>(header.bucket_count, STATA_KEY_INDEX_BUILD_MEMORY / 4 / sizeof(uint64_t));
+    uint64_t window_size = STATA_KEY_INDEX_BUILD_MEMORY / 2 / header.row_width;
+    uint64_t written = 0;
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> next;
+    std::vector<uint8_t> window;
+    for (uint64_t first = 0; first < header.bucket_count; first += buckets_per_pass) {
+        uint64_t last = MinValue<uint64_t>(first + buckets_per_pass, header.bucket_count);
+        offsets.assign(last - first + 1, 0);
+        offsets[0] = written;
+        for_each_row([&](uint64_t row, uint64_t bucket) {
+            if (bucket >= first && bucket < last) {
+                offsets[bucket - first + 1]++;
+            }
+        });
+        for (uint64_t i = 0; i < last - first; i++) {
+            offsets[i + 1] += offsets[i];
+        }
+        out.seekp(sizeof(Header) + first * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(offsets.data()), (last - first) * sizeof(uint64_t));
+
+        uint64_t end = offsets.back();
+        for (uint64_t window_start = written; window_start < end; window_start += window_size) {
+            uint64_t window_end = MinValue<uint64_t>(window_start + window_size, end);
+            window.resize((window_end - window_start) * header.row_width);
+            next.assign(offsets.begin(), offsets.end() - 1);
+            for_each_row([&](uint64_t row, uint64_t bucket) {
+                if (bucket < first || bucket >= last) {
+                    return;
+                }
+                uint64_t slot = next[bucket - first]++;
+                if (slot < window_start || slot >= window_end) {
+                    return;
+                }
+                uint8_t* entry = window.data() + (slot - window_start) * header.row_width;
+                if (header.row_width == 4) {
+                    auto row32 = static_cast<uint32_t>(row);
+                    std::memcpy(entry, &row32, sizeof(row32));
+                } else {
+                    std::memcpy(entry, &row, sizeof(row));
+                }
+            });
+            out.seekp(entries_start + window_start * header.row_width);
+            out.write(reinterpret_cast<const char*>(window.data()), window.size());
+        }
+        written = end;
+    }
+    header.entry_count = written;
+    out.seekp(sizeof(Header) + header.bucket_count * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(&written), sizeof(written));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+        std::remove(temp_path.c_str());
+        throw IOException("Failed to write key index: " + temp_path);
+    }
+
+    // The data file must not have changed while it was read, or the index is wrong
+    uint64_t size;
+    int64_t mtime;
+    if (!StataFileStamp(data_path, size, mtime) || size != header.source_size || mtime != header.source_mtime) {
+        std::remove(temp_path.c_str());
+        throw IOException("Stata file \"%s\" changed while its key index was built", data_path);
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        throw IOException("Cannot create key index: " + path);
+    }
+    return header.entry_count;
+}
+
+unique_ptr<StataKeyIndex> StataKeyIndex::Open(const std::string& data_path, const std::string& variable, idx_t nobs) {
+    uint64_t size;
+    int64_t mtime;
+    if (!StataFileStamp(data_path, size, mtime)) {
+        return nullptr;
+    }
+    auto result = unique_ptr<StataKeyIndex>(new StataKeyIndex());
+    result->file_.open(IndexPath(data_path, variable), std::ios::binary);
+    if (!result->file_.is_open()) {
+        return nullptr;
+    }
+    auto& header = result->header_;
+    result->file_.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!result->file_ || std::memcmp(header.magic, STATA_KEY_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != STATA_KEY_INDEX_VERSION || header.source_size != size || header.source_mtime != mtime ||
+        header.nobs != nobs || header.source_header_hash != StataSourceHeaderHash(data_path)) {
+        return nullptr;
+    }
+    return result;
+}
+
+uint64_t StataKeyIndex::ReadOffset(uint64_t bucket) {
+    uint64_t offset;
+    file_.seekg(sizeof(Header) + bucket * sizeof(uint64_t));
+    file_.read(reinterpret_cast<char*>(&offset), sizeof(offset));
+    return offset;
+}
+
+std::vector<idx_t> StataKeyIndex::Lookup(const vector<Value>& keys) {
+    std::vector<idx_t> rows;
+    uint64_t entries_start = sizeof(Header) + (header_.bucket_count + 1) * sizeof(uint64_t);
+    std::vector<uint8_t> buffer;
+    for (auto& key : keys) {
+        if (key.IsNull()) {
+            continue;
+        }
+        uint64_t bucket = HashKey(key) & (header_.bucket_count - 1);
+        uint64_t begin = ReadOffset(bucket);
+        uint64_t end = ReadOffset(bucket + 1);
+        if (!file_ || begin > end || end > header_.entry_count) {
+            throw IOException("Corrupt Stata key index");
+        }
+        buffer.resize((end - begin) * header_.row_width);
+        file_.seekg(entries_start + begin * header_.row_width);
+        file_.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+        for (uint64_t i = 0; i < end - begin; i++) {
+            if (header_.row_width == 4) {
+                uint32_t row;
+                std::memcpy(&row, buffer.data() + i * 4, sizeof(row));
+                rows.push_back(row);
+            } else {
+                uint64_t row;
+                std::memcpy(&row, buffer.data() + i * 8, sizeof(row));
+                rows.push_back(row);
+            }
+        }
+    }
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    return rows;
+}
+
+} // namespace duckdb
@@ -30,6 +30,7 @@ void StataParser::InitializeTypeMappings() {
     type_size_mapping_[StataDataType::LONG] = 4;
     type_size_mapping_[StataDataType::FLOAT] = 4;
     type_size_mapping_[StataDataType::DOUBLE] = 8;
+    type_size_mapping_[StataDataType::STRL] = 8;
 }
 
 void StataParser::InitializeMissingValues() {
@@ -72,25 +73,24 @@ T StataParser::SwapBytes(T value) {
     return value;
 }
 
-uint8_t StataParser::ReadUInt8() {
-    if (!file_stream_ || !file_stream_->good()) {
+void StataParser::ReadBytes(void* buffer, size_t length) {
+    if (!input_) {
         throw IOException("Cannot read from Stata file");
     }
-    
-    uint8_t value;
-    file_stream_->read(reinterpret_cast<char*>(&value), sizeof(value));
-    if (file_stream_->gcount() != sizeof(value)) {
+    if (input_->Read(buffer, length) != length) {
         throw IOException("Unexpected end of Stata file");
     }
+}
+
+uint8_t StataParser::ReadUInt8() {
+    uint8_t value;
+    ReadBytes(&value, sizeof(value));
     return value;
 }
 
 uint16_t StataParser::ReadUInt16() {
     uint16_t value;
-    file_stream_->read(reinterpret_cast<char*>(&value), sizeof(value));
-    if (file_stream_->gcount() != sizeof(value)) {
-        throw IOException("Unexpected end of Stata file");
-    }
+    ReadBytes(&value, sizeof(value));
     
     if (is_big_endian_ != native_is_big_endian_) {
         value = SwapBytes(value);
@@ -100,10 +100,7 @@ uint16_t StataParser::ReadUInt16() {
 
 uint32_t StataParser::ReadUInt32() {
     uint32_t value;
-    file_stream_->read(reinterpret_cast<char*>(&value), sizeof(value));
-    if (file_stream_->gcount() != sizeof(value)) {
-        throw IOException("Unexpected end of Stata file");
-    }
+    ReadBytes(&value, sizeof(value));
     
     if (is_big_endian_ != native_is_big_endian_) {
         value = SwapBytes(value);
@@ -113,10 +110,7 @@ uint32_t StataParser::ReadUInt32() {
 
 uint64_t StataParser::ReadUInt64() {
     uint64_t value;
-    file_stream_->read(reinterpret_cast<char*>(&value), sizeof(value));
-    if (file_stream_->gcount() != sizeof(value)) {
-        throw IOException("Unexpected end of Stata file");
-    }
+    ReadBytes(&value, sizeof(value));
     
     if (is_big_endian_ != native_is_big_endian_) {
         value = SwapBytes(value);
@@ -152,8 +146,7 @@ double StataParser::ReadDouble() {
 
 std::string StataParser::ReadString(size_t length) {
     std::vector<char> buffer(length);
-    file_stream_->read(buffer.data(), length);
-    if (static_cast<size_t>(file_stream_->gcount()) != length) {
+    if (!input_ || input_->Read(buffer.data(), length) != length) {
         throw IOException("Unexpected end of Stata file while reading string");
     }
     
@@ -162,13 +155,12 @@ std::string StataParser::ReadString(size_t length) {
 
 std::string StataParser::ReadNullTerminatedString(size_t max_length) {
     std::vector<char> buffer(max_length);
-    file_stream_->read(buffer.data(), max_length);
-    if (static_cast<size_t>(file_stream_->gcount()) != max_length) {
+    if (!input_ || input_->Read(buffer.data(), max_length) != max_length) {
         throw IOException("Unexpected end of Stata file while reading string");
     }
     
     // Find null terminator
-    size_t actual_length = 0;
+    size_t actual_length = max_length;
     for (size_t i = 0; i < max_length; i++) {
         if (buffer[i] == '\0') {
             actual_length = i;
@@ -191,9 +183,11 @@ LogicalType StataParser::StataTypeToLogicalType(const StataVariable& var) {
             return LogicalType::FLOAT;
         case StataDataType::DOUBLE:
             return LogicalType::DOUBLE;
+        case StataDataType::STRL:
+            return LogicalType::VARCHAR;
         default:
             // String types (1-244)
-            if (static_cast<uint8_t>(var.type) >= 1 && static_cast<uint8_t>(var.type) <= 244) {
+            if (IsStringType(var.type)) {
                 return LogicalType::VARCHAR;
             }
             throw NotImplementedException("Unsupported Stata data type");
@@ -201,16 +195,16 @@ LogicalType StataParser::StataTypeToLogicalType(const StataVariable& var) {
 }
 
 bool StataParser::IsStringType(StataDataType type) {
-    uint8_t type_code = static_cast<uint8_t>(type);
+    uint16_t type_code = static_cast<uint16_t>(type);
     return type_code >= 1 && type_code <= 244;
 }
 
 bool StataParser::IsNumericType(StataDataType type) {
-    return !IsStringType(type);
+    return !IsStringType(type) && type != StataDataType::STRL;
 }
 
 bool StataParser::IsMissingValue(const StataVariable& var, const void* data) {
-    if (IsStringType(var.type)) {
+    if (!IsNumericType(var.type)) {
         return false; // Strings don't have missing values in the same sense
     }
     
@@ -2,11 +2,18 @@
 #include "duckdb/common/exception.hpp"
 #include "duckdb/common/string_util.hpp"
 #include "duckdb/common/vector.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 
 namespace duckdb {
 
-StataReader::StataReader(const std::string& filename) 
-    : filename_(filename), data_location_(0), rows_read_(0) {
+// strL contents kept in memory per file; beyond this they are read on demand
+static constexpr uint64_t STATA_STRL_MEMORY = 64 * 1024 * 1024;
+
+StataReader::StataReader(const std::string& filename)
+    : filename_(filename), data_location_(0), rows_read_(0), row_size_(0) {
 }
 
 StataReader::~StataReader() {
@@ -15,22 +22,24 @@ StataReader::~StataReader() {
 
 bool StataReader::Open() {
     try {
-        file_stream_ = make_uniq<std::ifstream>(filename_, std::ios::binary);
-        if (!file_stream_->is_open()) {
-            throw IOException("Cannot open Stata file: " + filename_);
-        }
-        
+        input_ = OpenStataInputStream(filename_);
+
+        // All sections before <data> are read in file order, so the metadata can be
+        // parsed from forward-only sources such as compressed streams
         ReadHeader();
         ReadVariableTypes();
         ReadVariableNames();
         ReadSortOrder();
-        ReadFormats();
-        ReadValueLabelNames();
-        ReadVariableLabels();
-        ReadCharacteristics();
-        ReadValueLabels();
+        // Formats, labels and characteristics are only needed for metadata
+        // queries. Seekable inputs skip them here and parse them on first use.
+        metadata_location_ = GetFilePosition();
+        if (input_->CanSeek()) {
+            SkipMetadata();
+        } else {
+            ReadMetadata();
+        }
         PrepareDataReading();
-        
+
         return true;
     } catch (const IOException& e) {
         Close();
@@ -42,21 +51,18 @@ bool StataReader::Open() {
 }
 
 void StataReader::Close() {
-    if (file_stream_) {
-        file_stream_->close();
-        file_stream_.reset();
-    }
+    input_.reset();
 }
 
 void StataReader::ReadHeader() {
     uint8_t first_char = ReadUInt8();
-    
+
     if (first_char == '<') {
         ReadNewHeader();
     } else {
         ReadOldHeader(first_char);
     }
-    
+
     // Validate format version
     if (header_.format_version < 105 || header_.format_version > 119) {
         throw InvalidInputException(
@@ -68,98 +74,86 @@ void StataReader::ReadHeader() {
 
 void StataReader::ReadOldHeader(uint8_t first_char) {
     header_.format_version = first_char;
-    
+
     // Read byte order
     uint8_t byteorder = ReadUInt8();
     // Fix byte order detection: 0x2 = little-endian (LSF), 0x1 = big-endian (MSF)
     header_.is_big_endian = (byteorder == 0x1);
     SetByteOrder(header_.is_big_endian);
-    
+
     // Read file type
     header_.filetype = ReadUInt8();
-    
+
     // Skip unused byte
     SkipBytes(1);
-    
+
     // Read number of variables
     header_.nvar = ReadUInt16();
-    
+
     // Read number of observations
     header_.nobs = ReadObsCount();
-    
+
     // Read data label and timestamp
     header_.data_label = ReadDataLabel();
     header_.timestamp = ReadTimestamp();
 }
 
 void StataReader::ReadNewHeader() {
-    // For XML format (version 117+), we need to parse XML tags properly
-    // Read the entire header as a string first to locate tags
-    
-    // Read a large chunk to find the header section
-    uint64_t start_pos = GetFilePosition() - 1; // -1 because we already read the '<'
-    SeekTo(start_pos);
-    
-    std::string header_xml = ReadString(500); // Read enough to get all header info
-    
-    // Parse version from <release>VERSION</release>
-    size_t release_start = header_xml.find("<release>");
-    size_t release_end = header_xml.find("</release>");
-    if (release_start == std::string::npos || release_end == std::string::npos) {
-        throw IOException("Invalid XML format: could not find release tag");
-    }
-    std::string version_str = header_xml.substr(release_start + 9, release_end - release_start - 9);
+    // The XML-like formats (117+) are parsed tag by tag in file order.
+    // The leading '<' has already been consumed by ReadHeader.
+    ExpectTag("stata_dta>");
+    ExpectTag("<header>");
+
+    // <release>VERSION</release>
+    ExpectTag("<release>");
+    std::string version_str = ReadString(3);
+    if (version_str.find_first_not_of("0123456789") != std::string::npos) {
+        throw IOException("Invalid XML format: could not parse release tag");
+    }
     header_.format_version = std::stoi(version_str);
-    
-    // Parse byte order from <byteorder>ORDER</byteorder>
-    size_t byteorder_start = header_xml.find("<byteorder>");
-    size_t byteorder_end = header_xml.find("</byteorder>");
-    if (byteorder_start == std::string::npos || byteorder_end == std::string::npos) {
-        throw IOException("Invalid XML format: could not find byteorder tag");
-    }
-    std::string byteorder_str = header_xml.substr(byteorder_start + 11, byteorder_end - byteorder_start - 11);
+    ExpectTag("</release>");
+
+    // <byteorder>ORDER</byteorder>
+    ExpectTag("<byteorder>");
+    std::string byteorder_str = ReadString(3);
     header_.is_big_endian = (byteorder_str[0] == 'M'); // MSF = big-endian, LSF = little-endian
     SetByteOrder(header_.is_big_endian);
-    
-    // Parse number of variables from <K>BINARY_DATA</K>
-    size_t k_start = header_xml.find("<K>");
-    if (k_start == std::string::npos) {
-        throw IOException("Invalid XML format: could not find K tag");
-    }
-    // Position after the <K> tag to read binary data
-    SeekTo(start_pos + k_start + 3);
-    header_.nvar = ReadUInt16();
-    
-    // Parse number of observations from <N>BINARY_DATA</N>
-    size_t n_start = header_xml.find("<N>");
-    if (n_start == std::string::npos) {
-        throw IOException("Invalid XML format: could not find N tag");
-    }
-    // Position after the <N> tag to read binary data
-    SeekTo(start_pos + n_start + 3);
+    ExpectTag("</byteorder>");
+
+    // <K>BINARY_DATA</K>: 4 bytes in format 119, 2 bytes before
+    ExpectTag("<K>");
+    header_.nvar = (header_.format_version >= 119) ? ReadUInt32() : ReadUInt16();
+    ExpectTag("</K>");
+
+    // <N>BINARY_DATA</N>
+    ExpectTag("<N>");
     header_.nobs = ReadObsCount();
-    
-    // Parse data label from <label>BINARY_DATA</label>
-    size_t label_start = header_xml.find("<label>");
-    if (label_start != std::string::npos) {
-        SeekTo(start_pos + label_start + 7);
-        header_.data_label = ReadDataLabel();
-    }
-    
-    // Parse timestamp from <timestamp>TEXT</timestamp>
-    size_t timestamp_start = header_xml.find("<timestamp>");
-    size_t timestamp_end = header_xml.find("</timestamp>");
-    if (timestamp_start != std::string::npos && timestamp_end != std::string::npos) {
-        header_.timestamp = header_xml.substr(timestamp_start + 11, timestamp_end - timestamp_start - 11);
-    }
-    
-    // Find the end of the header section to continue parsing
-    size_t header_end = header_xml.find("</header>");
-    if (header_end != std::string::npos) {
-        SeekTo(start_pos + header_end + 9);
-    } else {
-        throw IOException("Invalid XML format: could not find header end tag");
+    ExpectTag("</N>");
+
+    // <label>BINARY_DATA</label>
+    ExpectTag("<label>");
+    header_.data_label = ReadDataLabel();
+    ExpectTag("</label>");
+
+    // <timestamp>TEXT</timestamp>
+    ExpectTag("<timestamp>");
+    header_.timestamp = ReadTimestamp();
+    ExpectTag("</timestamp>");
+
+    ExpectTag("</header>");
+    ReadMap();
+}
+
+void StataReader::ReadMap() {
+    // <map> holds the file offsets of all sections: stata_data, map, variable_types,
+    // varnames, sortlist, formats, value_label_names, variable_labels,
+    // characteristics, data, strls, value_labels, </stata_data> and end of file
+    ExpectTag("<map>");
+    section_map_.resize(14);
+    for (auto& offset : section_map_) {
+        offset = ReadUInt64();
     }
+    ExpectTag("</map>");
 }
 
 uint64_t StataReader::ReadObsCount() {
@@ -175,450 +169,887 @@ std::string StataReader::ReadDataLabel() {
         uint16_t length = ReadUInt16();
         return ReadString(length);
     } else if (header_.format_version == 117) {
+        uint8_t length = ReadUInt8();
+        return ReadString(length);
+    } else if (header_.format_version > 105) {
         return ReadNullTerminatedString(81);
     } else {
-        return ReadNullTerminatedString(81);
+        return ReadNullTerminatedString(32);
     }
 }
 
 std::string StataReader::ReadTimestamp() {
     if (header_.format_version >= 117) {
-        return ReadNullTerminatedString(18);
+        uint8_t length = ReadUInt8();
+        return ReadString(length);
     } else {
         return ReadNullTerminatedString(18);
     }
 }
 
+std::vector<std::string> StataReader::ReadFixedWidthStrings(size_t width) {
+    std::vector<std::string> result;
+    result.reserve(header_.nvar);
+    for (uint32_t i = 0; i < header_.nvar; i++) {
+        result.push_back(ReadNullTerminatedString(width));
+    }
+    return result;
+}
+
 void StataReader::ReadVariableTypes() {
     variables_.resize(header_.nvar);
-    
-    if (header_.format_version >= 117) {
-        // XML format: find <variable_types> section
-        std::string section_data = FindXMLSection("variable_types");
-        
-        // Parse binary data within the XML section
-        // For version 118+, there seems to be padding bytes, so we skip every other byte
-        for (uint16_t i = 0; i < header_.nvar; i++) {
-            size_t byte_index = (header_.format_version >= 118) ? i * 2 : i;
-            if (byte_index >= section_data.length()) {
-                throw IOException("Invalid variable types section: insufficient data");
-            }
-            uint8_t type_code = static_cast<uint8_t>(section_data[byte_index]);
-            
-            // For version 118+, handle the new type codes
-            if (type_code >= 1 && type_code <= 244) {
-                variables_[i].type = static_cast<StataDataType>(type_code);
-                variables_[i].str_len = type_code;
-            } else if (type_code == 248) {
-                // Version 118+: Based on analysis, 248 appears to be LONG/INT32, not DOUBLE
-                variables_[i].type = StataDataType::LONG;
-            } else if (type_code == 249) {
-                // Version 118+: 249 appears to be INT16
-                variables_[i].type = StataDataType::INT;
-            } else if (type_code == 250) {
-                // Version 118+: 250 appears to be BYTE/INT8
-                variables_[i].type = StataDataType::BYTE;
-            } else if (type_code == 254) {
-                variables_[i].type = StataDataType::FLOAT;
-            } else if (type_code == 253) {
-                variables_[i].type = StataDataType::LONG;
-            } else if (type_code == 252) {
-                variables_[i].type = StataDataType::INT;
-            } else if (type_code == 251) {
-                variables_[i].type = StataDataType::BYTE;
+
+    if (IsXMLFormat()) {
+        // XML format: 2-byte type codes
+        ExpectTag("<variable_types>");
+        for (uint32_t i = 0; i < header_.nvar; i++) {
+            uint16_t type_code = ReadUInt16();
+            auto& var = variables_[i];
+
+            if (type_code >= 1 && type_code <= 2045) {
+                // strN: fixed-width string of N bytes
+                var.type = StataDataType::STR1_244;
+                var.str_len = type_code;
+            } else if (type_code == 32768) {
+                var.type = StataDataType::STRL;
+            } else if (type_code == 65530) {
+                var.type = StataDataType::BYTE;
+            } else if (type_code == 65529) {
+                var.type = StataDataType::INT;
+            } else if (type_code == 65528) {
+                var.type = StataDataType::LONG;
+            } else if (type_code == 65527) {
+                var.type = StataDataType::FLOAT;
+            } else if (type_code == 65526) {
+                var.type = StataDataType::DOUBLE;
             } else {
-                variables_[i].type = static_cast<StataDataType>(type_code);
+                throw NotImplementedException("Unsupported Stata data type code: %d", type_code);
             }
         }
+        ExpectTag("</variable_types>");
     } else {
         // Binary format
-        for (uint16_t i = 0; i < header_.nvar; i++) {
+        for (uint32_t i = 0; i < header_.nvar; i++) {
             uint8_t type_code = ReadUInt8();
-            
-            if (header_.format_version <= 115 && old_type_mapping_.count(type_code)) {
-                variables_[i].type = old_type_mapping_[type_code];
+            auto& var = variables_[i];
+
+            if (header_.format_version <= 108) {
+                // Letter codes for numbers, 127 + width for strings
+                if (old_type_mapping_.count(type_code)) {
+                    var.type = old_type_mapping_[type_code];
+                } else {
+                    var.type = StataDataType::STR1_244;
+                    var.str_len = type_code - 127;
+                }
             } else if (type_code >= 1 && type_code <= 244) {
-                variables_[i].type = static_cast<StataDataType>(type_code);
-                variables_[i].str_len = type_code;
+                var.type = static_cast<StataDataType>(type_code);
+                var.str_len = type_code;
             } else {
-                variables_[i].type = static_cast<StataDataType>(type_code);
+                var.type = static_cast<StataDataType>(type_code);
             }
         }
     }
 }
 
 void StataReader::ReadVariableNames() {
-    if (header_.format_version >= 117) {
-        // XML format: find <varnames> section
-        std::string section_data = FindXMLSection("varnames");
-        
-        // Parse null-terminated strings from the section data
-        size_t pos = 0;
-        size_t name_length = (header_.format_version <= 117) ? 33 : 129;
-        
-        for (uint16_t i = 0; i < header_.nvar; i++) {
-            // Each variable name is fixed-width (129 bytes for version 118+)
-            size_t start_pos = i * name_length;
-            if (start_pos >= section_data.length()) {
-                throw IOException("Invalid variable names section: insufficient data");
-            }
-            
-            // Extract the fixed-width name and find null terminator
-            std::string raw_name = section_data.substr(start_pos, 
-                std::min(name_length, section_data.length() - start_pos));
-            size_t null_pos = raw_name.find('\0');
-            
-            if (null_pos != std::string::npos) {
-                variables_[i].name = raw_name.substr(0, null_pos);
-            } else {
-                variables_[i].name = raw_name;
-            }
-        }
-    } else {
-        // Binary format
-        size_t name_length = (header_.format_version <= 117) ? 33 : 129;
-        
-        for (uint16_t i = 0; i < header_.nvar; i++) {
-            variables_[i].name = ReadNullTerminatedString(name_length);
-        }
+    size_t name_length = NameWidth();
+
+    if (IsXMLFormat()) {
+        ExpectTag("<varnames>");
+    }
+    auto names = ReadFixedWidthStrings(name_length);
+    for (uint32_t i = 0; i < header_.nvar; i++) {
+        variables_[i].name = names[i];
+    }
+    if (IsXMLFormat()) {
+        ExpectTag("</varnames>");
     }
 }
 
 void StataReader::ReadSortOrder() {
-    if (header_.format_version >= 117) {
-        // XML format: find <sortlist> section and skip
-        try {
-            std::string section_data = FindXMLSection("sortlist");
-            // Just skip the sort order data for now
-        } catch (const IOException&) {
-            // Sort order section might not exist, that's okay
+    // nvar + 1 entries (the list is zero-terminated); 4 bytes each in format 119
+    size_t entry_size = (header_.format_version >= 119) ? 4 : 2;
+
+    if (IsXMLFormat()) {
+        ExpectTag("<sortlist>");
+    }
+    // 1-based variable numbers, up to the first 0
+    header_.sort_order.clear();
+    bool terminated = false;
+    for (size_t i = 0; i <= header_.nvar; i++) {
+        uint32_t variable = entry_size == 4 ? ReadUInt32() : ReadUInt16();
+        if (variable == 0 || variable > header_.nvar) {
+            terminated = true;
         }
-    } else {
-        // Binary format: Sort order: 2 bytes per variable + 2 bytes for count
-        size_t sort_size = 2 * (header_.nvar + 1);
-        SkipBytes(sort_size);
+        if (!terminated) {
+            header_.sort_order.push_back(variable - 1);
+        }
+    }
+    if (IsXMLFormat()) {
+        ExpectTag("</sortlist>");
     }
 }
 
-void StataReader::ReadFormats() {
-    if (header_.format_version >= 117) {
-        // XML format: find <formats> section
-        std::string section_data = FindXMLSection("formats");
-        
-        // Parse null-terminated strings from the section data
-        size_t pos = 0;
-        size_t format_length = (header_.format_version <= 117) ? 49 : 57;
-        
-        for (uint16_t i = 0; i < header_.nvar; i++) {
-            if (pos >= section_data.length()) {
-                variables_[i].format = "";
-                continue;
-            }
-            
-            // Find the null terminator
-            size_t format_end = section_data.find('\0', pos);
-            if (format_end == std::string::npos) {
-                variables_[i].format = section_data.substr(pos);
-                break;
-            } else {
-                variables_[i].format = section_data.substr(pos, format_end - pos);
-                // Move to next format (fixed-width alignment)
-                pos = ((pos / format_length) + 1) * format_length;
-            }
-        }
+size_t StataReader::FormatWidth() const {
+    if (header_.format_version >= 118) {
+        return 57;
+    } else if (header_.format_version > 113) {
+        return 49;
+    } else if (header_.format_version > 104) {
+        return 12;
     } else {
-        // Binary format
-        size_t format_length = (header_.format_version <= 117) ? 49 : 57;
-        
-        for (uint16_t i = 0; i < header_.nvar; i++) {
-            variables_[i].format = ReadNullTerminatedString(format_length);
+        return 7;
+    }
+}
+
+size_t StataReader::NameWidth() const {
+    return (header_.format_version >= 118) ? 129 : (header_.format_version > 108 ? 33 : 9);
+}
+
+size_t StataReader::VariableLabelWidth() const {
+    return (header_.format_version >= 118) ? 321 : (header_.format_version > 105 ? 81 : 32);
+}
+
+void StataReader::ReadMetadata() {
+    ReadFormats();
+    ReadValueLabelNames();
+    ReadVariableLabels();
+    // Parsed in passing, as forward-only inputs cannot come back for them
+    characteristics_.clear();
+    ReadCharacteristics(&characteristics_);
+    characteristics_loaded_ = true;
+    metadata_loaded_ = true;
+}
+
+void StataReader::SkipMetadata() {
+    if (!IsXMLFormat()) {
+        SkipBytes(header_.nvar * (FormatWidth() + NameWidth() + VariableLabelWidth()));
+        ReadCharacteristics(nullptr);
+        return;
+    }
+    // The map of 117+ files points straight at <data>; parse the sections in
+    // order if it does not
+    if (section_map_[9] >= metadata_location_) {
+        SeekTo(section_map_[9]);
+        if (ReadString(6) == "<data>") {
+            SeekTo(section_map_[9]);
+            return;
         }
+        SeekTo(metadata_location_);
     }
+    ReadMetadata();
 }
 
-void StataReader::ReadValueLabelNames() {
-    if (header_.format_version >= 117) {
-        // XML format: find <value_label_names> section
-        try {
-            std::string section_data = FindXMLSection("value_label_names");
-            
-            // Parse null-terminated strings from the section data
-            size_t pos = 0;
-            size_t label_length = (header_.format_version <= 117) ? 33 : 129;
-            
-            for (uint16_t i = 0; i < header_.nvar; i++) {
-                if (pos >= section_data.length()) {
-                    variables_[i].value_label_name = "";
-                    continue;
-                }
-                
-                // Find the null terminator
-                size_t name_end = section_data.find('\0', pos);
-                if (name_end == std::string::npos) {
-                    variables_[i].value_label_name = section_data.substr(pos);
-                    break;
-                } else {
-                    variables_[i].value_label_name = section_data.substr(pos, name_end - pos);
-                    // Move to next name (fixed-width alignment)
-                    pos = ((pos / label_length) + 1) * label_length;
-                }
+void StataReader::LoadMetadata() {
+    if (metadata_loaded_) {
+        return;
+    }
+    if (!input_) {
+        throw IOException("Stata file is not open: " + filename_);
+    }
+    SeekTo(metadata_location_);
+    ReadMetadata();
+}
+
+const std::map<std::string, std::map<int32_t, std::string>>& StataReader::LoadValueLabels() {
+    if (value_labels_loaded_) {
+        return value_labels_;
+    }
+    if (!input_) {
+        throw IOException("Stata file is not open: " + filename_);
+    }
+    // Formats 108 and earlier store value labels in an older layout that is not
+    // read, as in pandas
+    if (header_.format_version <= 108) {
+        value_labels_loaded_ = true;
+        return value_labels_;
+    }
+
+    if (IsXMLFormat()) {
+        SeekTo(section_map_[11]);
+        ReadValueLabels();
+    } else {
+        // Tables follow the data until the end of the file, each preceded by its length
+        SeekTo(value_labels_location_);
+        while (true) {
+            uint32_t length;
+            size_t read = input_->Read(&length, sizeof(length));
+            if (read == 0) {
+                break;
             }
-        } catch (const IOException&) {
-            // Value label names section might not exist, set empty strings
-            for (uint16_t i = 0; i < header_.nvar; i++) {
-                variables_[i].value_label_name = "";
+            if (read != sizeof(length)) {
+                throw IOException("Unexpected end of Stata file in value labels");
             }
+            ReadValueLabelTable();
         }
-    } else {
-        // Binary format
-        size_t label_length = (header_.format_version <= 117) ? 33 : 129;
-        
-        for (uint16_t i = 0; i < header_.nvar; i++) {
-            variables_[i].value_label_name = ReadNullTerminatedString(label_length);
+    }
+    value_labels_loaded_ = true;
+    return value_labels_;
+}
+
+void StataReader::ReadValueLabels() {
+    ExpectTag("<value_labels>");
+    while (true) {
+        std::string tag = ReadString(5);
+        if (tag == "<lbl>") {
+            ReadUInt32(); // Length of the table
+            ReadValueLabelTable();
+            ExpectTag("</lbl>");
+        } else if (tag == "</val") {
+            ExpectTag("ue_labels>");
+            break;
+        } else {
+            throw IOException("Invalid XML format: malformed value_labels section");
+        }
+    }
+    value_labels_loaded_ = true;
+}
+
+void StataReader::ReadValueLabelTable() {
+    // Name, 3 bytes of padding, then n, the text length, n text offsets, n values
+    // and the null-terminated texts
+    std::string name = ReadNullTerminatedString(NameWidth());
+    SkipBytes(3);
+    uint32_t count = ReadUInt32();
+    uint32_t text_length = ReadUInt32();
+    std::vector<uint32_t> offsets(count);
+    for (auto& offset : offsets) {
+        offset = ReadUInt32();
+    }
+    std::vector<int32_t> values(count);
+    for (auto& value : values) {
+        value = ReadInt32();
+    }
+    std::string text = ReadString(text_length);
+
+    auto& table = value_labels_[name];
+    for (uint32_t i = 0; i < count; i++) {
+        if (offsets[i] >= text_length) {
+            throw IOException("Invalid Stata value label table: " + name);
         }
+        table[values[i]] = std::string(text.c_str() + offsets[i]);
+    }
+}
+
+void StataReader::ReadFormats() {
+    size_t format_length = FormatWidth();
+
+    if (IsXMLFormat()) {
+        ExpectTag("<formats>");
+    }
+    auto formats = ReadFixedWidthStrings(format_length);
+    for (uint32_t i = 0; i < header_.nvar; i++) {
+        variables_[i].format = formats[i];
+    }
+    if (IsXMLFormat()) {
+        ExpectTag("</formats>");
+    }
+}
+
+void StataReader::ReadValueLabelNames() {
+    size_t label_length = NameWidth();
+
+    if (IsXMLFormat()) {
+        ExpectTag("<value_label_names>");
+    }
+    auto names = ReadFixedWidthStrings(label_length);
+    for (uint32_t i = 0; i < header_.nvar; i++) {
+        variables_[i].value_label_name = names[i];
+    }
+    if (IsXMLFormat()) {
+        ExpectTag("</value_label_names>");
     }
 }
 
 void StataReader::ReadVariableLabels() {
-    if (header_.format_version >= 117) {
-        // XML format: find <variable_labels> section
-        try {
-            std::string section_data = FindXMLSection("variable_labels");
-            
-            // Parse null-terminated strings from the section data
-            size_t pos = 0;
-            size_t label_length = (header_.format_version <= 117) ? 81 : 321;
-            
-            for (uint16_t i = 0; i < header_.nvar; i++) {
-                if (pos >= section_data.length()) {
-                    variables_[i].label = "";
-                    continue;
-                }
-                
-                // Find the null terminator
-                size_t label_end = section_data.find('\0', pos);
-                if (label_end == std::string::npos) {
-                    variables_[i].label = section_data.substr(pos);
-                    break;
-                } else {
-                    variables_[i].label = section_data.substr(pos, label_end - pos);
-                    // Move to next label (fixed-width alignment)
-                    pos = ((pos / label_length) + 1) * label_length;
-                }
-            }
-        } catch (const IOException&) {
-            // Variable labels section might not exist, set empty strings
-            for (uint16_t i = 0; i < header_.nvar; i++) {
-                variables_[i].label = "";
+    size_t label_length = VariableLabelWidth();
+
+    if (IsXMLFormat()) {
+        ExpectTag("<variable_labels>");
+    }
+    auto labels = ReadFixedWidthStrings(label_length);
+    for (uint32_t i = 0; i < header_.nvar; i++) {
+        variables_[i].label = labels[i];
+    }
+    if (IsXMLFormat()) {
+        ExpectTag("</variable_labels>");
+    }
+}
+
+void StataReader::ReadCharacteristics(std::vector<StataCharacteristic>* characteristics) {
+    // With characteristics == nullptr the section is skipped
+    if (IsXMLFormat()) {
+        // XML format: a sequence of <ch>LENGTH CONTENTS</ch> entries
+        ExpectTag("<characteristics>");
+        while (true) {
+            std::string tag = ReadString(4);
+            if (tag == "<ch>") {
+                uint32_t length = ReadUInt32();
+                ReadCharacteristic(length, characteristics);
+                ExpectTag("</ch>");
+            } else if (tag == "</ch") {
+                ExpectTag("aracteristics>");
+                break;
+            } else {
+                throw IOException("Invalid XML format: malformed characteristics section");
             }
         }
-    } else {
-        // Binary format
-        size_t label_length = (header_.format_version <= 117) ? 81 : 321;
-        
-        for (uint16_t i = 0; i < header_.nvar; i++) {
-            variables_[i].label = ReadNullTerminatedString(label_length);
+    } else if (header_.format_version > 104) {
+        // Binary format: expansion fields of (type, length, contents),
+        // terminated by an entry of type 0. Type 1 holds a characteristic.
+        while (true) {
+            uint8_t data_type = ReadUInt8();
+            uint32_t data_len = (header_.format_version > 108) ? ReadUInt32() : ReadUInt16();
+            if (data_type == 0) {
+                break;
+            }
+            if (data_type == 1) {
+                ReadCharacteristic(data_len, characteristics);
+            } else {
+                SkipBytes(data_len);
+            }
         }
     }
 }
 
-void StataReader::ReadCharacteristics() {
-    // Skip characteristics for now - they're optional metadata
-    if (header_.format_version >= 117) {
-        // XML format: find <characteristics> section and skip
-        try {
-            std::string section_data = FindXMLSection("characteristics");
-            // Just skip the characteristics data for now
-        } catch (const IOException&) {
-            // Characteristics section might not exist, that's okay
-        }
+void StataReader::ReadCharacteristic(uint32_t length, std::vector<StataCharacteristic>* characteristics) {
+    // Variable name (or _dta), characteristic name, then the null-terminated contents
+    size_t name_width = NameWidth();
+    if (!characteristics || length < 2 * name_width) {
+        SkipBytes(length);
+        return;
+    }
+    StataCharacteristic characteristic;
+    characteristic.variable = ReadNullTerminatedString(name_width);
+    characteristic.name = ReadNullTerminatedString(name_width);
+    characteristic.contents = ReadString(length - 2 * name_width);
+    auto terminator = characteristic.contents.find('\0');
+    if (terminator != std::string::npos) {
+        characteristic.contents.resize(terminator);
     }
-    // For older versions, characteristics are typically not present or minimal
+    characteristics->push_back(std::move(characteristic));
 }
 
-void StataReader::ReadValueLabels() {
-    // Value labels are complex - skip for initial implementation
-    // TODO: Implement value label reading
-    if (header_.format_version >= 117) {
-        // XML format: find <value_labels> section and skip
-        try {
-            std::string section_data = FindXMLSection("value_labels");
-            // Just skip the value labels data for now
-        } catch (const IOException&) {
-            // Value labels section might not exist, that's okay
-        }
+const std::vector<StataCharacteristic>& StataReader::LoadCharacteristics() {
+    if (characteristics_loaded_) {
+        return characteristics_;
+    }
+    if (!input_) {
+        throw IOException("Stata file is not open: " + filename_);
+    }
+    // Straight to the section through the map, or past the fixed-width
+    // sections that precede it in older formats
+    if (IsXMLFormat()) {
+        SeekTo(section_map_[8]);
+    } else {
+        SeekTo(metadata_location_ + header_.nvar * (FormatWidth() + NameWidth() + VariableLabelWidth()));
     }
-    // For older versions, value labels are typically at the end and can be skipped
+    ReadCharacteristics(&characteristics_);
+    characteristics_loaded_ = true;
+    return characteristics_;
 }
 
 void StataReader::PrepareDataReading() {
-    if (header_.format_version >= 117) {
-        // XML format: Find the <data> section
-        SeekTo(0);
-        file_stream_->seekg(0, std::ios::end);
-        uint64_t file_size = file_stream_->tellg();
-        SeekTo(0);
-        
-        std::string file_content(file_size, '\0');
-        file_stream_->read(&file_content[0], file_size);
-        
-        // Look for the <data> tag
-        size_t data_start_tag = file_content.find("<data>");
-        size_t data_end_tag = file_content.find("</data>");
-        
-        if (data_start_tag != std::string::npos && data_end_tag != std::string::npos) {
-            data_location_ = data_start_tag + 6; // After "<data>"
-            
-            // Calculate actual data size from XML boundaries
-            uint64_t xml_data_size = data_end_tag - (data_start_tag + 6);
-            
-            // Calculate expected row size
-            uint64_t expected_row_size = 0;
-            for (const auto& var : variables_) {
-                if (IsStringType(var.type)) {
-                    expected_row_size += var.str_len;
-                } else {
-                    expected_row_size += type_size_mapping_[var.type];
-                }
-            }
-            
-            // Adjust number of observations if the data section is smaller
-            if (expected_row_size > 0) {
-                uint64_t max_possible_rows = xml_data_size / expected_row_size;
-                if (max_possible_rows < header_.nobs) {
-                    header_.nobs = max_possible_rows;
-                }
-            }
+    // Fixed-width row layout
+    column_offsets_.clear();
+    column_offsets_.reserve(variables_.size());
+    row_size_ = 0;
+    for (const auto& var : variables_) {
+        column_offsets_.push_back(row_size_);
+        if (IsStringType(var.type)) {
+            row_size_ += var.str_len;
+        } else if (type_size_mapping_.count(var.type)) {
+            row_size_ += type_size_mapping_[var.type];
         } else {
-            throw IOException("Could not find <data> section in XML format file");
+            throw NotImplementedException("Unsupported Stata data type");
         }
-    } else {
+    }
+
+    if (IsXMLFormat()) {
+        ExpectTag("<data>");
         data_location_ = GetFilePosition();
-        
-        // FIXME: There's a 5-byte offset issue with version 114 files generated by pandas
-        // This needs to be investigated and fixed properly by analyzing the file format
-        if (header_.format_version == 114) {
-            data_location_ += 5;
+
+        // The map tells where </data> ends (the <strls> offset), which bounds the
+        // number of rows actually present in the data section
+        uint64_t strls_location = section_map_[10];
+        uint64_t data_end = data_location_ + header_.nobs * row_size_;
+        if (strls_location >= data_location_ + 7 && strls_location - 7 < data_end && row_size_ > 0) {
+            uint64_t xml_data_size = strls_location - 7 - data_location_;
+            header_.nobs = xml_data_size / row_size_;
         }
+    } else {
+        data_location_ = GetFilePosition();
     }
-    
+    value_labels_location_ = data_location_ + header_.nobs * row_size_;
+
     // Prepare column types for DuckDB
+    column_types_.clear();
     column_types_.reserve(header_.nvar);
     for (const auto& var : variables_) {
         column_types_.push_back(StataTypeToLogicalType(var));
     }
+
+    // Decode every variable until told otherwise. strL contents are not loaded
+    // here, so opening a file never reads past the start of <data>.
+    std::vector<idx_t> all_columns(variables_.size());
+    for (idx_t col = 0; col < all_columns.size(); col++) {
+        all_columns[col] = col;
+    }
+    projection_ = std::move(all_columns);
+    reads_rows_ = !projection_.empty();
+    projects_strl_ = HasStrLColumns(projection_);
+}
+
+bool StataReader::HasStrLColumns(const std::vector<idx_t>& columns) const {
+    for (auto col : columns) {
+        if (col < variables_.size() && variables_[col].type == StataDataType::STRL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void StataReader::SetProjection(std::vector<idx_t> columns) {
+    reads_rows_ = false;
+    for (auto col : columns) {
+        if (col < variables_.size()) {
+            reads_rows_ = true;
+        }
+    }
+    projects_strl_ = HasStrLColumns(columns);
+    projection_ = std::move(columns);
+    // Load before any cursor is opened so that all cursors share the contents
+    if (projects_strl_ && !strls_) {
+        LoadStrls();
+    }
+}
+
+void StataReader::LoadStrls() {
+    auto strls = make_shared_ptr<std::unordered_map<uint64_t, StataStrLEntry>>();
+    uint64_t strls_location = section_map_[10];
+
+    if (input_->CanSeek()) {
+        SeekTo(strls_location);
+        ReadStrls(*strls);
+        SeekTo(data_location_);
+    } else {
+        // Forward-only input (pipe or compressed stream): <strls> comes after the
+        // rows that reference it, so copy the data section and <strls> to a
+        // temporary file while streaming past them, then read both from that copy
+        uint64_t strls_end = section_map_[11];
+        if (strls_end < strls_location || strls_location < data_location_) {
+            throw IOException("Invalid Stata file: section map is out of order");
+        }
+        uint64_t spill_size = strls_end - data_location_;
+        if (spill_options_.directory.empty()) {
+            throw IOException("Reading strL variables from \"%s\" requires spilling %llu bytes to the temporary "
+                              "directory, but temp_directory is not set. Decompress the file or set temp_directory.",
+                              filename_, spill_size);
+        }
+        if (spill_size > spill_options_.max_bytes) {
+            throw IOException("Reading strL variables from \"%s\" requires spilling %llu bytes to the temporary "
+                              "directory, more than the %llu allowed by max_temp_directory_size. Decompress the file "
+                              "or raise max_temp_directory_size.",
+                              filename_, spill_size, spill_options_.max_bytes);
+        }
+        auto spill = make_shared_ptr<StataTemporaryFile>(spill_options_.directory);
+        std::ofstream out(spill->GetPath(), std::ios::binary);
+        if (!out.is_open()) {
+            throw IOException("Cannot create temporary file for Stata data: " + spill->GetPath());
+        }
+        std::vector<uint8_t> buffer(1024 * 1024);
+        uint64_t remaining = spill_size;
+        while (remaining > 0) {
+            size_t block = static_cast<size_t>(std::min<uint64_t>(remaining, buffer.size()));
+            ReadBytes(buffer.data(), block);
+            out.write(reinterpret_cast<const char*>(buffer.data()), block);
+            remaining -= block;
+        }
+        out.close();
+        if (!out) {
+            throw IOException("Failed to write temporary file for Stata data: " + spill->GetPath());
+        }
+        // The input now stands at <value_labels>, which the spill does not hold.
+        // Formats and characteristics came before <data> and are already parsed.
+        if (!value_labels_loaded_) {
+            ReadValueLabels();
+        }
+
+        input_ = make_uniq<StataFileInputStream>(spill->GetPath());
+        SeekTo(strls_location - data_location_);
+        ReadStrls(*strls);
+        data_location_ = 0;
+        SeekTo(data_location_);
+        spill_file_ = std::move(spill);
+    }
+    strls_ = std::move(strls);
+}
+
+void StataReader::ReadStrls(std::unordered_map<uint64_t, StataStrLEntry>& strls) {
+    // <strls> holds GSO entries: "GSO", v (4 bytes), o (4 bytes in 117, 8 after),
+    // t (129 binary, 130 null-terminated ASCII), len (4 bytes) and the contents.
+    // Contents are kept in memory up to STATA_STRL_MEMORY bytes in total; the
+    // others are read from the input when a row refers to them.
+    uint64_t kept = 0;
+    ExpectTag("<strls>");
+    while (true) {
+        std::string tag = ReadString(3);
+        if (tag == "</s") {
+            ExpectTag("trls>");
+            break;
+        }
+        if (tag != "GSO") {
+            throw IOException("Invalid XML format: malformed strls section");
+        }
+        uint64_t v = ReadUInt32();
+        uint64_t o = (header_.format_version >= 118) ? ReadUInt64() : ReadUInt32();
+        StataStrLEntry strl;
+        strl.null_terminated = ReadUInt8() == 130;
+        strl.length = ReadUInt32();
+        strl.offset = GetFilePosition();
+        strl.loaded = kept + strl.length <= STATA_STRL_MEMORY;
+        if (strl.loaded) {
+            strl.contents = ReadString(strl.length);
+            if (strl.null_terminated && !strl.contents.empty() && strl.contents.back() == '\0') {
+                strl.contents.pop_back();
+            }
+            kept += strl.length;
+        } else {
+            SkipBytes(strl.length);
+        }
+
+        // Same packing as the references in the data section, see DecodeStrLReference
+        size_t v_size = (header_.format_version == 117) ? 4 : (header_.format_version == 118 ? 2 : 3);
+        strls[(v << (8 * (8 - v_size))) | o] = std::move(strl);
+    }
+}
+
+std::string StataReader::FetchStrL(const StataStrLEntry& strl) {
+    if (strl.loaded) {
+        return strl.contents;
+    }
+    // The input is left where it was, so a sequential scan carries on from there
+    auto position = GetFilePosition();
+    SeekTo(strl.offset);
+    auto contents = ReadString(strl.length);
+    SeekTo(position);
+    if (strl.null_terminated && !contents.empty() && contents.back() == '\0') {
+        contents.pop_back();
+    }
+    return contents;
+}
+
+uint64_t StataReader::DecodeStrLReference(const uint8_t* src, bool swap) const {
+    // The 8 bytes hold v (variable) and o (observation) in the file's byte order:
+    // 4+4 bytes in format 117, 2+6 in 118 and 3+5 in 119
+    size_t v_size = (header_.format_version == 117) ? 4 : (header_.format_version == 118 ? 2 : 3);
+    uint64_t value;
+    std::memcpy(&value, src, sizeof(value));
+    if (swap) {
+        auto bytes = reinterpret_cast<uint8_t*>(&value);
+        std::reverse(bytes, bytes + sizeof(value));
+    }
+    uint64_t v, o;
+    if (header_.is_big_endian) {
+        v = value >> (8 * (8 - v_size));
+        o = value & ((uint64_t(1) << (8 * (8 - v_size))) - 1);
+    } else {
+        v = value & ((uint64_t(1) << (8 * v_size)) - 1);
+        o = value >> (8 * v_size);
+    }
+    return (v << (8 * (8 - v_size))) | o;
 }
 
 unique_ptr<DataChunk> StataReader::ReadChunk(idx_t chunk_size) {
     if (!HasMoreData()) {
         return nullptr;
     }
-    
+
+    vector<LogicalType> types;
+    for (auto col : projection_) {
+        types.push_back(col < column_types_.size() ? column_types_[col] : LogicalType(LogicalType::BIGINT));
+    }
     auto chunk = make_uniq<DataChunk>();
-    chunk->Initialize(Allocator::DefaultAllocator(), column_types_, chunk_size);
-    
+    chunk->Initialize(Allocator::DefaultAllocator(), types, chunk_size);
+
     ReadDataChunk(*chunk, chunk_size);
-    
+
     return chunk;
 }
 
 void StataReader::ReadDataChunk(DataChunk& chunk, idx_t chunk_size) {
     // Calculate actual rows to read
     idx_t rows_to_read = std::min(chunk_size, static_cast<idx_t>(header_.nobs - rows_read_));
-    
+
     if (rows_to_read == 0) {
         chunk.SetCardinality(0);
         return;
     }
-    
-    // Seek to correct position
-    uint64_t row_size = 0;
-    for (const auto& var : variables_) {
-        if (IsStringType(var.type)) {
-            row_size += var.str_len;
-        } else {
-            row_size += type_size_mapping_[var.type];
-        }
-    }
-    
-    uint64_t data_offset = data_location_ + (rows_read_ * row_size);
-    
-    
-    SeekTo(data_offset);
-    
-    // Read data for each row
-    for (idx_t row = 0; row < rows_to_read; row++) {
-        for (size_t col = 0; col < variables_.size(); col++) {
-            const auto& var = variables_[col];
-            auto& vector = chunk.data[col];
-            
-            if (IsStringType(var.type)) {
-                std::string str_data = ReadString(var.str_len);
-                // Remove null terminator and trailing nulls
-                size_t actual_len = str_data.find('\0');
-                if (actual_len != std::string::npos) {
-                    str_data = str_data.substr(0, actual_len);
-                }
-                FlatVector::GetData<string_t>(vector)[row] = StringVector::AddString(vector, str_data);
-            } else {
-                std::vector<uint8_t> raw_data(type_size_mapping_[var.type]);
-                file_stream_->read(reinterpret_cast<char*>(raw_data.data()), raw_data.size());
-                
-                ConvertStataValue(var, raw_data.data(), vector, row);
+
+    ReadRows(rows_read_, rows_to_read, chunk);
+    rows_read_ += rows_to_read;
+}
+
+bool StataReader::ReadsRows(const std::vector<bool>* skip) const {
+    if (!reads_rows_ || !skip) {
+        return reads_rows_;
+    }
+    for (idx_t i = 0; i < projection_.size(); i++) {
+        if (!(*skip)[i] && projection_[i] < variables_.size()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void StataReader::ReadRows(idx_t first_row, idx_t count, DataChunk& chunk, const std::vector<bool>* skip) {
+    // Without any variable to decode (e.g. COUNT(*)) the data section is not touched
+    rows_buffered_ = ReadsRows(skip);
+    if (rows_buffered_) {
+        if (projects_strl_ && !strls_) {
+            LoadStrls();
+        }
+        SeekTo(data_location_ + first_row * row_size_);
+
+        // Read the rows in one go and decode column by column from the buffer
+        row_buffer_.resize(count * row_size_);
+        ReadBytes(row_buffer_.data(), row_buffer_.size());
+    }
+    DecodeProjection(first_row, nullptr, count, chunk, skip);
+}
+
+void StataReader::BufferSelectedRows(const idx_t* rows, idx_t count) {
+    if (projects_strl_ && !strls_) {
+        LoadStrls();
+    }
+    // Gather the rows into one buffer, reading runs of adjacent rows at once
+    row_buffer_.resize(count * row_size_);
+    idx_t i = 0;
+    while (i < count) {
+        idx_t run = 1;
+        while (i + run < count && rows[i + run] == rows[i] + run) {
+            run++;
+        }
+        SeekTo(data_location_ + rows[i] * row_size_);
+        ReadBytes(row_buffer_.data() + i * row_size_, run * row_size_);
+        i += run;
+    }
+}
+
+void StataReader::ReadSelectedRows(const idx_t* rows, idx_t count, DataChunk& chunk,
+                                   const std::vector<bool>* skip) {
+    rows_buffered_ = ReadsRows(skip);
+    if (rows_buffered_) {
+        BufferSelectedRows(rows, count);
+    }
+    DecodeProjection(0, rows, count, chunk, skip);
+}
+
+void StataReader::DecodeSkipped(idx_t first_row, const idx_t* rows, const SelectionVector* sel, idx_t count,
+                                DataChunk& chunk, const std::vector<bool>& skip) {
+    std::vector<idx_t> selected_rows;
+    if (!rows_buffered_) {
+        // The earlier call decoded nothing from the rows (e.g. the filters only
+        // needed cached variables or rowid), so only the selected rows are read
+        selected_rows.resize(count);
+        for (idx_t i = 0; i < count; i++) {
+            idx_t row = sel ? sel->get_index(i) : i;
+            selected_rows[i] = rows ? rows[row] : first_row + row;
+        }
+        rows = selected_rows.data();
+        BufferSelectedRows(rows, count);
+    } else if (sel) {
+        // Move the selected rows to the front of the buffer. sel is ascending, so a
+        // row's slot is only overwritten once the row itself has been moved.
+        selected_rows.resize(count);
+        for (idx_t i = 0; i < count; i++) {
+            idx_t row = sel->get_index(i);
+            if (row != i) {
+                std::memcpy(row_buffer_.data() + i * row_size_, row_buffer_.data() + row * row_size_, row_size_);
             }
+            selected_rows[i] = rows ? rows[row] : first_row + row;
         }
+        rows = selected_rows.data();
     }
-    
-    chunk.SetCardinality(rows_to_read);
-    rows_read_ += rows_to_read;
+    std::vector<bool> decoded(skip.size());
+    for (idx_t i = 0; i < skip.size(); i++) {
+        decoded[i] = !skip[i];
+    }
+    DecodeProjection(first_row, rows, count, chunk, &decoded);
 }
 
-void StataReader::ConvertStataValue(const StataVariable& var, const uint8_t* src_data, Vector& dest_vector, idx_t row_idx) {
-    if (IsMissingValue(var, src_data)) {
-        FlatVector::SetNull(dest_vector, row_idx, true);
+void StataReader::DecodeProjection(idx_t first_row, const idx_t* rows, idx_t count, DataChunk& chunk,
+                                   const std::vector<bool>* skip) {
+    for (idx_t i = 0; i < projection_.size(); i++) {
+        idx_t col = projection_[i];
+        if (skip && (*skip)[i]) {
+            continue;
+        }
+        if (col < variables_.size()) {
+            DecodeColumn(variables_[col], row_buffer_.data(), count, column_offsets_[col], chunk.data[i]);
+        } else if (col == COLUMN_IDENTIFIER_ROW_ID) {
+            auto row_ids = FlatVector::GetData<int64_t>(chunk.data[i]);
+            for (idx_t row = 0; row < count; row++) {
+                row_ids[row] = NumericCast<int64_t>(rows ? rows[row] : first_row + row);
+            }
+        } else {
+            chunk.data[i].SetVectorType(VectorType::CONSTANT_VECTOR);
+            ConstantVector::SetNull(chunk.data[i], true);
+        }
+    }
+    chunk.SetCardinality(count);
+}
+
+Value StataReader::ReadValue(idx_t row, idx_t column) {
+    if (variables_[column].type == StataDataType::STRL && !strls_) {
+        LoadStrls();
+    }
+    SeekTo(data_location_ + row * row_size_);
+    row_buffer_.resize(row_size_);
+    ReadBytes(row_buffer_.data(), row_buffer_.size());
+
+    Vector result(column_types_[column], 1);
+    DecodeColumn(variables_[column], row_buffer_.data(), 1, column_offsets_[column], result);
+    return result.GetValue(0);
+}
+
+unique_ptr<StataReader> StataReader::OpenCursor() const {
+    if (!input_) {
+        return nullptr;
+    }
+    auto stream = input_->Clone();
+    if (!stream) {
+        return nullptr;
+    }
+
+    auto cursor = make_uniq<StataReader>(filename_);
+    cursor->input_ = std::move(stream);
+    cursor->SetByteOrder(header_.is_big_endian);
+    cursor->header_ = header_;
+    cursor->variables_ = variables_;
+    cursor->column_types_ = column_types_;
+    cursor->section_map_ = section_map_;
+    cursor->data_location_ = data_location_;
+    cursor->column_offsets_ = column_offsets_;
+    cursor->row_size_ = row_size_;
+    cursor->strls_ = strls_;
+    cursor->projection_ = projection_;
+    cursor->metadata_location_ = metadata_location_;
+    cursor->metadata_loaded_ = metadata_loaded_;
+    cursor->value_labels_location_ = value_labels_location_;
+    cursor->reads_rows_ = reads_rows_;
+    cursor->projects_strl_ = projects_strl_;
+    cursor->spill_file_ = spill_file_;
+    cursor->spill_options_ = spill_options_;
+    return cursor;
+}
+
+template <class T>
+static inline T LoadStataValue(const uint8_t* src, bool swap) {
+    T value;
+    std::memcpy(&value, src, sizeof(T));
+    if (swap) {
+        auto bytes = reinterpret_cast<uint8_t*>(&value);
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    return value;
+}
+
+void StataReader::DecodeColumn(const StataVariable& var, const uint8_t* rows, idx_t row_count,
+                               uint64_t column_offset, Vector& dest_vector) {
+    bool swap = is_big_endian_ != native_is_big_endian_;
+    const uint8_t* src = rows + column_offset;
+    auto& validity = FlatVector::Validity(dest_vector);
+
+    if (IsStringType(var.type)) {
+        auto data = FlatVector::GetData<string_t>(dest_vector);
+        for (idx_t row = 0; row < row_count; row++, src += row_size_) {
+            // Strings are null-padded to the column width
+            auto end = static_cast<const uint8_t*>(std::memchr(src, '\0', var.str_len));
+            size_t length = end ? static_cast<size_t>(end - src) : var.str_len;
+            data[row] = StringVector::AddString(dest_vector, reinterpret_cast<const char*>(src), length);
+        }
         return;
     }
-    
+
+    if (var.type == StataDataType::STRL) {
+        auto data = FlatVector::GetData<string_t>(dest_vector);
+        for (idx_t row = 0; row < row_count; row++, src += row_size_) {
+            // (0,0) is the empty string and has no GSO entry
+            auto entry = strls_->find(DecodeStrLReference(src, swap));
+            if (entry == strls_->end()) {
+                data[row] = string_t("", 0);
+            } else if (entry->second.loaded) {
+                data[row] = StringVector::AddString(dest_vector, entry->second.contents);
+            } else {
+                data[row] = StringVector::AddString(dest_vector, FetchStrL(entry->second));
+            }
+        }
+        return;
+    }
+
+    // Values above the largest non-missing value are Stata missing values (., .a-.z)
     switch (var.type) {
         case StataDataType::BYTE: {
-            int8_t value = *reinterpret_cast<const int8_t*>(src_data);
-            FlatVector::GetData<int8_t>(dest_vector)[row_idx] = value;
+            auto data = FlatVector::GetData<int8_t>(dest_vector);
+            for (idx_t row = 0; row < row_count; row++, src += row_size_) {
+                int8_t value = static_cast<int8_t>(*src);
+                if (value > 100) {
+                    validity.SetInvalid(row);
+                } else {
+                    data[row] = value;
+                }
+            }
             break;
         }
         case StataDataType::INT: {
-            int16_t value = *reinterpret_cast<const int16_t*>(src_data);
-            if (is_big_endian_ != native_is_big_endian_) {
-                value = SwapBytes(value);
+            auto data = FlatVector::GetData<int16_t>(dest_vector);
+            for (idx_t row = 0; row < row_count; row++, src += row_size_) {
+                int16_t value = LoadStataValue<int16_t>(src, swap);
+                if (value > 32740) {
+                    validity.SetInvalid(row);
+                } else {
+                    data[row] = value;
+                }
             }
-            FlatVector::GetData<int16_t>(dest_vector)[row_idx] = value;
             break;
         }
         case StataDataType::LONG: {
-            int32_t value = *reinterpret_cast<const int32_t*>(src_data);
-            if (is_big_endian_ != native_is_big_endian_) {
-                value = SwapBytes(value);
+            auto data = FlatVector::GetData<int32_t>(dest_vector);
+            for (idx_t row = 0; row < row_count; row++, src += row_size_) {
+                int32_t value = LoadStataValue<int32_t>(src, swap);
+                if (value > 2147483620) {
+                    validity.SetInvalid(row);
+                } else {
+                    data[row] = value;
+                }
             }
-            FlatVector::GetData<int32_t>(dest_vector)[row_idx] = value;
             break;
         }
         case StataDataType::FLOAT: {
-            uint32_t int_value = *reinterpret_cast<const uint32_t*>(src_data);
-            if (is_big_endian_ != native_is_big_endian_) {
-                int_value = SwapBytes(int_value);
+            auto data = FlatVector::GetData<float>(dest_vector);
+            for (idx_t row = 0; row < row_count; row++, src += row_size_) {
+                float value = LoadStataValue<float>(src, swap);
+                // Missing floats start at 2^127
+                if (std::isnan(value) || value >= 1.70141183e+38f) {
+                    validity.SetInvalid(row);
+                } else {
+                    data[row] = value;
+                }
             }
-            float value;
-            std::memcpy(&value, &int_value, sizeof(float));
-            FlatVector::GetData<float>(dest_vector)[row_idx] = value;
             break;
         }
         case StataDataType::DOUBLE: {
-            uint64_t int_value = *reinterpret_cast<const uint64_t*>(src_data);
-            if (is_big_endian_ != native_is_big_endian_) {
-                int_value = SwapBytes(int_value);
+            auto data = FlatVector::GetData<double>(dest_vector);
+            for (idx_t row = 0; row < row_count; row++, src += row_size_) {
+                double value = LoadStataValue<double>(src, swap);
+                // Missing doubles start at 2^1023 (approximately 8.988e+307)
+                if (value >= 8.988e+307) {
+                    validity.SetInvalid(row);
+                } else {
+                    data[row] = value;
+                }
             }
-            double value;
-            std::memcpy(&value, &int_value, sizeof(double));
-            FlatVector::GetData<double>(dest_vector)[row_idx] = value;
             break;
         }
         default:
@@ -626,67 +1057,27 @@ void StataReader::ConvertStataValue(const StataVariable& var, const uint8_t* src
     }
 }
 
-std::string StataReader::DecodeString(const uint8_t* data, size_t length) {
-    // Basic ASCII decoding - could be enhanced for other encodings
-    std::string result(reinterpret_cast<const char*>(data), length);
-    
-    // Remove null terminators
-    size_t null_pos = result.find('\0');
-    if (null_pos != std::string::npos) {
-        result = result.substr(0, null_pos);
-    }
-    
-    return result;
-}
-
 void StataReader::SkipBytes(size_t count) {
-    file_stream_->seekg(count, std::ios::cur);
+    input_->Skip(count);
 }
 
 uint64_t StataReader::GetFilePosition() {
-    return file_stream_->tellg();
+    return input_->GetPosition();
 }
 
 void StataReader::SeekTo(uint64_t position) {
-    file_stream_->seekg(position);
-}
-
-std::string StataReader::FindXMLSection(const std::string& section_name) {
-    // Save current position
-    uint64_t original_pos = GetFilePosition();
-    
-    // Go back to start of file to search for the section
-    SeekTo(0);
-    
-    // Read the entire file (or a very large portion)
-    file_stream_->seekg(0, std::ios::end);
-    uint64_t file_size = file_stream_->tellg();
-    SeekTo(0);
-    
-    // Read all the file content
-    std::string file_content(file_size, '\0');
-    file_stream_->read(&file_content[0], file_size);
-    
-    // Find the section tags
-    std::string start_tag = "<" + section_name + ">";
-    std::string end_tag = "</" + section_name + ">";
-    
-    size_t start_pos = file_content.find(start_tag);
-    size_t end_pos = file_content.find(end_tag);
-    
-    if (start_pos == std::string::npos || end_pos == std::string::npos) {
-        // Restore position and throw error
-        SeekTo(original_pos);
-        throw IOException("Could not find XML section: " + section_name);
-    }
-    
-    size_t content_start = start_pos + start_tag.length();
-    std::string section_content = file_content.substr(content_start, end_pos - content_start);
-    
-    // Restore original position
-    SeekTo(original_pos);
-    
-    return section_content;
-}
-
-} // namespace duckdb
\ No newline at end of file
+    if (position == input_->GetPosition()) {
+        return;
+    }
+    // Sequential sources support forward positioning only
+    input_->SeekTo(position);
+}
+
+void StataReader::ExpectTag(const std::string& tag) {
+    std::string actual = ReadString(tag.size());
+    if (actual != tag) {
+        throw IOException("Invalid XML format: could not find " + tag + " tag");
+    }
+}
+
+} // namespace duckdb
@@ -0,0 +1,268 @@
+#include "stata_schema_cache.hpp"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/common/local_file_system.hpp"
+#include "duckdb/common/types/uuid.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace duckdb {
+
+static constexpr char STATA_SCHEMA_CACHE_MAGIC[8] = {'S', 'T', 'A', 'T', 'A', 'S', 'C', 'H'};
+static constexpr uint32_t STATA_SCHEMA_CACHE_VERSION = 1;
+
+namespace {
+
+// Appends fixed-width values and length-prefixed strings in native byte order;
+// the cache is only ever read back on the machine that wrote it
+class CacheWriter {
+public:
+    template <class T> void Write(T value) {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void WriteString(const std::string& value) {
+        Write<uint32_t>(static_cast<uint32_t>(value.size()));
+        buffer.append(value);
+    }
+
+    std::string buffer;
+};
+
+// Reads what CacheWriter wrote; any read past the end marks the cache corrupt
+class CacheReader {
+public:
+    CacheReader(const std::string& buffer) : buffer_(buffer), position_(0), ok_(true) {
+    }
+
+    template <class T> T Read() {
+        T value {};
+        if (position_ + sizeof(T) > buffer_.size()) {
+            ok_ = false;
+            return value;
+        }
+        std::memcpy(&value, buffer_.data() + position_, sizeof(T));
+        position_ += sizeof(T);
+        return value;
+    }
+    std::string ReadString() {
+        auto length = Read<uint32_t>();
+        if (!ok_ || position_ + length > buffer_.size()) {
+            ok_ = false;
+            return std::string();
+        }
+        std::string value = buffer_.substr(position_, length);
+        position_ += length;
+        return value;
+    }
+    bool Ok() const {
+        return ok_;
+    }
+
+private:
+    const std::string& buffer_;
+    size_t position_;
+    bool ok_;
+};
+
+} // namespace
+
+static shared_ptr<const StataSchema> StataReadSchema(const std::string& data_path) {
+    StataReader reader(data_path);
+    if (!reader.Open()) {
+        throw IOException("Cannot open Stata file: " + data_path);
+    }
+    reader.LoadMetadata();
+    auto schema = make_shared_ptr<StataSchema>();
+    schema->header = reader.GetHeader();
+    schema->variables = reader.GetVariables();
+    return schema;
+}
+
+shared_ptr<StataSchemaCache> StataSchemaCache::Get(const std::string& path) {
+    static mutex caches_lock;
+    static std::unordered_map<std::string, shared_ptr<StataSchemaCache>> caches;
+
+    auto absolute = StataAbsolutePath(path);
+    lock_guard<mutex> guard(caches_lock);
+    auto& cache = caches[absolute];
+    if (!cache) {
+        cache = make_shared_ptr<StataSchemaCache>(absolute);
+    }
+    return cache;
+}
+
+StataSchemaCache::StataSchemaCache(std::string path) : path_(std::move(path)) {
+}
+
+shared_ptr<const StataSchema> StataSchemaCache::Lookup(const std::string& data_path) {
+    uint64_t size;
+    int64_t mtime;
+    if (!StataFileStamp(data_path, size, mtime)) {
+        return nullptr;
+    }
+    auto key = StataAbsolutePath(data_path);
+    {
+        lock_guard<mutex> guard(lock_);
+        Refresh();
+        auto entry = entries_.find(key);
+        if (entry != entries_.end() && entry->second.size == size && entry->second.mtime == mtime) {
+            return entry->second.schema;
+        }
+    }
+
+    // Parsed without the lock, so threads listing many files do not wait on each other
+    auto schema = StataReadSchema(data_path);
+    lock_guard<mutex> guard(lock_);
+    entries_[key] = Entry {size, mtime, schema};
+    pending_.insert(key);
+    return schema;
+}
+
+void StataSchemaCache::Flush() {
+    lock_guard<mutex> guard(lock_);
+    if (pending_.empty()) {
+        return;
+    }
+    // Processes flush one at a time, each merging what the one before wrote.
+    // Creating the lock file fails like any other write; taking the lock does
+    // not wait, and the entries are kept for the next flush if another process
+    // holds it.
+    LocalFileSystem fs;
+    auto lock_path = path_ + ".lock";
+    fs.OpenFile(lock_path, FileFlags::FILE_FLAGS_WRITE | FileFlags::FILE_FLAGS_FILE_CREATE);
+    unique_ptr<FileHandle> lock_file;
+    try {
+        lock_file = fs.OpenFile(lock_path, FileFlags::FILE_FLAGS_WRITE | FileFlags::FILE_FLAGS_FILE_CREATE |
+                                               FileLockType::WRITE_LOCK);
+    } catch (IOException&) {
+        return;
+    }
+    Refresh();
+    Write();
+    pending_.clear();
+}
+
+void StataSchemaCache::Refresh() {
+    uint64_t size;
+    int64_t mtime;
+    if (!StataFileStamp(path_, size, mtime) || (loaded_ && size == file_size_ && mtime == file_mtime_)) {
+        return;
+    }
+    loaded_ = true;
+    file_size_ = size;
+    file_mtime_ = mtime;
+
+    std::ifstream in(path_, std::ios::binary);
+    std::string buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    CacheReader reader(buffer);
+    char magic[8];
+    for (auto& c : magic) {
+        c = reader.Read<char>();
+    }
+    if (std::memcmp(magic, STATA_SCHEMA_CACHE_MAGIC, sizeof(magic)) != 0 ||
+        reader.Read<uint32_t>() != STATA_SCHEMA_CACHE_VERSION) {
+        // Not a cache this version wrote; it is replaced on the next flush
+        return;
+    }
+
+    std::unordered_map<std::string, Entry> entries;
+    auto count = reader.Read<uint64_t>();
+    for (uint64_t i = 0; i < count && reader.Ok(); i++) {
+        auto key = reader.ReadString();
+        Entry entry;
+        entry.size = reader.Read<uint64_t>();
+        entry.mtime = reader.Read<int64_t>();
+        auto schema = make_shared_ptr<StataSchema>();
+        auto& header = schema->header;
+        header.format_version = reader.Read<uint8_t>();
+        header.is_big_endian = reader.Read<uint8_t>() != 0;
+        header.filetype = reader.Read<uint8_t>();
+        header.nvar = reader.Read<uint32_t>();
+        header.nobs = reader.Read<uint64_t>();
+        header.data_label = reader.ReadString();
+        header.timestamp = reader.ReadString();
+        auto sort_count = reader.Read<uint32_t>();
+        for (uint32_t j = 0; j < sort_count && reader.Ok(); j++) {
+            header.sort_order.push_back(reader.Read<uint32_t>());
+        }
+        for (uint32_t j = 0; j < header.nvar && reader.Ok(); j++) {
+            StataVariable var;
+            var.name = reader.ReadString();
+            var.type = static_cast<StataDataType>(reader.Read<uint16_t>());
+            var.str_len = reader.Read<uint16_t>();
+            var.format = reader.ReadString();
+            var.label = reader.ReadString();
+            var.value_label_name = reader.ReadString();
+            schema->variables.push_back(std::move(var));
+        }
+        entry.schema = std::move(schema);
+        entries[key] = std::move(entry);
+    }
+    if (!reader.Ok()) {
+        return;
+    }
+    // Entries recorded here and not yet written win over what is on disk
+    for (auto& entry : entries) {
+        if (pending_.find(entry.first) == pending_.end()) {
+            entries_[entry.first] = std::move(entry.second);
+        }
+    }
+}
+
+void StataSchemaCache::Write() {
+    CacheWriter writer;
+    for (auto c : STATA_SCHEMA_CACHE_MAGIC) {
+        writer.Write<char>(c);
+    }
+    writer.Write<uint32_t>(STATA_SCHEMA_CACHE_VERSION);
+    writer.Write<uint64_t>(entries_.size());
+    for (auto& entry : entries_) {
+        writer.WriteString(entry.first);
+        writer.Write<uint64_t>(entry.second.size);
+        writer.Write<int64_t>(entry.second.mtime);
+        auto& header = entry.second.schema->header;
+        writer.Write<uint8_t>(header.format_version);
+        writer.Write<uint8_t>(header.is_big_endian ? 1 : 0);
+        writer.Write<uint8_t>(header.filetype);
+        writer.Write<uint32_t>(static_cast<uint32_t>(entry.second.schema->variables.size()));
+        writer.Write<uint64_t>(header.nobs);
+        writer.WriteString(header.data_label);
+        writer.WriteString(header.timestamp);
+        writer.Write<uint32_t>(static_cast<uint32_t>(header.sort_order.size()));
+        for (auto column : header.sort_order) {
+            writer.Write<uint32_t>(column);
+        }
+        for (auto& var : entry.second.schema->variables) {
+            writer.WriteString(var.name);
+            writer.Write<uint16_t>(static_cast<uint16_t>(var.type));
+            writer.Write<uint16_t>(var.str_len);
+            writer.WriteString(var.format);
+            writer.WriteString(var.label);
+            writer.WriteString(var.value_label_name);
+        }
+    }
+
+    // Written under a unique name and moved into place so readers never see a partial cache
+    auto temp_path = path_ + "." + UUID::ToString(UUID::GenerateRandomUUID()) + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw IOException("Cannot create Stata schema cache: " + temp_path);
+        }
+        out.write(writer.buffer.data(), writer.buffer.size());
+        out.close();
+        if (!out) {
+            std::remove(temp_path.c_str());
+            throw IOException("Failed to write Stata schema cache: " + temp_path);
+        }
+    }
+    if (std::rename(temp_path.c_str(), path_.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        throw IOException("Cannot create Stata schema cache: " + path_);
+    }
+    StataFileStamp(path_, file_size_, file_mtime_);
+    loaded_ = true;
+}
+
+} // namespace duckdb
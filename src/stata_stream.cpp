@@ -0,0 +1,435 @@
+#include "stata_stream.hpp"
+#include "duckdb/common/exception.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+
+namespace duckdb {
+
+static constexpr size_t STATA_COMPRESSED_BUFFER_SIZE = 256 * 1024;
+static constexpr uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;
+static constexpr uint32_t ZSTD_SKIPPABLE_SEEK_TABLE_MAGIC = 0x184D2A5E;
+
+static uint32_t LoadLittleEndian32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static uint64_t LoadLittleEndian64(const uint8_t* data) {
+    return static_cast<uint64_t>(LoadLittleEndian32(data)) |
+           (static_cast<uint64_t>(LoadLittleEndian32(data + 4)) << 32);
+}
+
+//===--------------------------------------------------------------------===//
+// StataInputStream
+//===--------------------------------------------------------------------===//
+void StataInputStream::Skip(uint64_t count) {
+    uint8_t discard[8192];
+    while (count > 0) {
+        size_t to_read = static_cast<size_t>(std::min<uint64_t>(count, sizeof(discard)));
+        size_t bytes_read = Read(discard, to_read);
+        if (bytes_read == 0) {
+            throw IOException("Unexpected end of Stata file");
+        }
+        count -= bytes_read;
+    }
+}
+
+void StataInputStream::SeekTo(uint64_t position) {
+    uint64_t current = GetPosition();
+    if (position < current) {
+        throw IOException("Cannot seek backwards in a sequential Stata input stream");
+    }
+    Skip(position - current);
+}
+
+//===--------------------------------------------------------------------===//
+// StataFileInputStream
+//===--------------------------------------------------------------------===//
+StataFileInputStream::StataFileInputStream(const std::string& path)
+    : path_(path), file_(path, std::ios::binary), seekable_(StataIsRegularFile(path)), position_(0) {
+    if (!file_.is_open()) {
+        throw IOException("Cannot open Stata file: " + path);
+    }
+}
+
+size_t StataFileInputStream::Read(void* buffer, size_t length) {
+    auto out = reinterpret_cast<char*>(buffer);
+    size_t from_pushback = std::min(length, pushback_.size());
+    if (from_pushback > 0) {
+        std::memcpy(out, pushback_.data(), from_pushback);
+        pushback_.erase(0, from_pushback);
+    }
+
+    size_t bytes_read = from_pushback;
+    if (bytes_read < length) {
+        file_.read(out + bytes_read, length - bytes_read);
+        bytes_read += static_cast<size_t>(file_.gcount());
+        if (bytes_read < length) {
+            // Clear eof so that later seeks keep working
+            file_.clear();
+        }
+    }
+    position_ += bytes_read;
+    return bytes_read;
+}
+
+void StataFileInputStream::Skip(uint64_t count) {
+    if (!seekable_) {
+        StataInputStream::Skip(count);
+        return;
+    }
+    SeekTo(position_ + count);
+}
+
+void StataFileInputStream::SeekTo(uint64_t position) {
+    if (!seekable_) {
+        // Pipes can only move forward
+        StataInputStream::SeekTo(position);
+        return;
+    }
+    pushback_.clear();
+    file_.clear();
+    file_.seekg(position);
+    position_ = position;
+}
+
+unique_ptr<StataInputStream> StataFileInputStream::Clone() const {
+    if (!seekable_) {
+        return nullptr;
+    }
+    return make_uniq<StataFileInputStream>(path_);
+}
+
+void StataFileInputStream::Unread(const uint8_t* data, size_t length) {
+    pushback_.insert(0, reinterpret_cast<const char*>(data), length);
+    position_ -= length;
+}
+
+//===--------------------------------------------------------------------===//
+// StataCompressedInputStream
+//===--------------------------------------------------------------------===//
+StataCompressedInputStream::StataCompressedInputStream(const std::string& path, unique_ptr<StataInputStream> source,
+                                                       shared_ptr<const std::vector<StataSeekPoint>> seek_points)
+    : path_(path), seek_points_(std::move(seek_points)), source_(std::move(source)),
+      in_buffer_(STATA_COMPRESSED_BUFFER_SIZE), in_pos_(0), in_size_(0), file_eof_(false), position_(0) {
+}
+
+size_t StataCompressedInputStream::Read(void* buffer, size_t length) {
+    auto out = reinterpret_cast<uint8_t*>(buffer);
+    size_t total = 0;
+    while (total < length) {
+        if (in_pos_ == in_size_ && !file_eof_) {
+            in_size_ = source_->Read(in_buffer_.data(), in_buffer_.size());
+            in_pos_ = 0;
+            if (in_size_ == 0) {
+                file_eof_ = true;
+            }
+        }
+        size_t consumed = 0;
+        size_t produced = Decompress(in_buffer_.data() + in_pos_, in_size_ - in_pos_, consumed,
+                                     out + total, length - total);
+        in_pos_ += consumed;
+        total += produced;
+        if (produced == 0 && consumed == 0) {
+            if (in_pos_ == in_size_ && file_eof_) {
+                break; // End of the compressed stream
+            }
+            if (in_pos_ < in_size_) {
+                throw IOException("Corrupt compressed Stata file: " + path_);
+            }
+        }
+    }
+    position_ += total;
+    return total;
+}
+
+void StataCompressedInputStream::SeekTo(uint64_t position) {
+    if (position == position_) {
+        return;
+    }
+    if (!CanSeek()) {
+        // Forward-only: decompress and discard
+        StataInputStream::SeekTo(position);
+        return;
+    }
+
+    // Find the last independent frame that starts at or before the target
+    auto& points = *seek_points_;
+    auto it = std::upper_bound(points.begin(), points.end(), position,
+                               [](uint64_t pos, const StataSeekPoint& point) {
+                                   return pos < point.uncompressed_offset;
+                               });
+    if (it != points.begin()) {
+        --it;
+    }
+    // Keep decoding when the target lies ahead within the current frame
+    if (position > position_ && it->uncompressed_offset <= position_) {
+        Skip(position - position_);
+        return;
+    }
+    RestartAt(*it);
+    Skip(position - position_);
+}
+
+void StataCompressedInputStream::RestartAt(const StataSeekPoint& point) {
+    source_->SeekTo(point.compressed_offset);
+    in_pos_ = 0;
+    in_size_ = 0;
+    file_eof_ = false;
+    position_ = point.uncompressed_offset;
+    ResetDecoder();
+}
+
+//===--------------------------------------------------------------------===//
+// StataGzipInputStream
+//===--------------------------------------------------------------------===//
+StataGzipInputStream::StataGzipInputStream(const std::string& path, unique_ptr<StataInputStream> source,
+                                           shared_ptr<const std::vector<StataSeekPoint>> seek_points)
+    : StataCompressedInputStream(path, std::move(source), std::move(seek_points)), zstream_(make_uniq<z_stream_s>()) {
+    std::memset(zstream_.get(), 0, sizeof(z_stream_s));
+    // 15 window bits + 32: detect gzip and zlib headers automatically
+    if (inflateInit2(zstream_.get(), 15 + 32) != Z_OK) {
+        throw IOException("Failed to initialize gzip decompression for " + path);
+    }
+}
+
+StataGzipInputStream::~StataGzipInputStream() {
+    inflateEnd(zstream_.get());
+}
+
+unique_ptr<StataInputStream> StataGzipInputStream::Clone() const {
+    if (!CanSeek()) {
+        return nullptr;
+    }
+    return make_uniq<StataGzipInputStream>(path_, make_uniq<StataFileInputStream>(path_), seek_points_);
+}
+
+void StataGzipInputStream::ResetDecoder() {
+    inflateReset(zstream_.get());
+}
+
+size_t StataGzipInputStream::Decompress(const uint8_t* in, size_t in_size, size_t& consumed,
+                                        uint8_t* out, size_t out_size) {
+    auto zs = zstream_.get();
+    zs->next_in = const_cast<Bytef*>(in);
+    zs->avail_in = static_cast<uInt>(in_size);
+    zs->next_out = out;
+    zs->avail_out = static_cast<uInt>(out_size);
+
+    int ret = inflate(zs, Z_NO_FLUSH);
+    consumed = in_size - zs->avail_in;
+    size_t produced = out_size - zs->avail_out;
+    if (ret == Z_STREAM_END) {
+        // Multi-member files (bgzip, pigz --independent) continue with the next member
+        inflateReset(zs);
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        throw IOException("Failed to decompress gzip Stata file " + path_ + ": " +
+                          std::string(zs->msg ? zs->msg : "corrupt data"));
+    }
+    return produced;
+}
+
+shared_ptr<const std::vector<StataSeekPoint>> StataGzipInputStream::ReadIndex(const std::string& path) {
+    // bgzip .gzi layout: uint64 count, then (compressed, uncompressed) offset pairs, little-endian
+    std::ifstream index(path + ".gzi", std::ios::binary);
+    if (!index.is_open()) {
+        return nullptr;
+    }
+    uint8_t buffer[16];
+    index.read(reinterpret_cast<char*>(buffer), 8);
+    if (index.gcount() != 8) {
+        return nullptr;
+    }
+    uint64_t count = LoadLittleEndian64(buffer);
+
+    auto points = make_shared_ptr<std::vector<StataSeekPoint>>();
+    points->push_back(StataSeekPoint {0, 0});
+    for (uint64_t i = 0; i < count; i++) {
+        index.read(reinterpret_cast<char*>(buffer), 16);
+        if (index.gcount() != 16) {
+            throw IOException("Truncated gzip index: " + path + ".gzi");
+        }
+        points->push_back(StataSeekPoint {LoadLittleEndian64(buffer), LoadLittleEndian64(buffer + 8)});
+    }
+    return points;
+}
+
+//===--------------------------------------------------------------------===//
+// StataZstdInputStream
+//===--------------------------------------------------------------------===//
+StataZstdInputStream::StataZstdInputStream(const std::string& path, unique_ptr<StataInputStream> source,
+                                           shared_ptr<const std::vector<StataSeekPoint>> seek_points)
+    : StataCompressedInputStream(path, std::move(source), std::move(seek_points)), dctx_(ZSTD_createDCtx()) {
+    if (!dctx_) {
+        throw IOException("Failed to initialize zstd decompression for " + path);
+    }
+}
+
+StataZstdInputStream::~StataZstdInputStream() {
+    ZSTD_freeDCtx(dctx_);
+}
+
+unique_ptr<StataInputStream> StataZstdInputStream::Clone() const {
+    if (!CanSeek()) {
+        return nullptr;
+    }
+    return make_uniq<StataZstdInputStream>(path_, make_uniq<StataFileInputStream>(path_), seek_points_);
+}
+
+void StataZstdInputStream::ResetDecoder() {
+    ZSTD_DCtx_reset(dctx_, ZSTD_reset_session_only);
+}
+
+size_t StataZstdInputStream::Decompress(const uint8_t* in, size_t in_size, size_t& consumed,
+                                        uint8_t* out, size_t out_size) {
+    ZSTD_inBuffer input = {in, in_size, 0};
+    ZSTD_outBuffer output = {out, out_size, 0};
+    // Concatenated frames and skippable frames (the seek table) are handled by the decoder
+    size_t ret = ZSTD_decompressStream(dctx_, &output, &input);
+    if (ZSTD_isError(ret)) {
+        throw IOException("Failed to decompress zstd Stata file " + path_ + ": " +
+                          std::string(ZSTD_getErrorName(ret)));
+    }
+    consumed = input.pos;
+    return output.pos;
+}
+
+shared_ptr<const std::vector<StataSeekPoint>> StataZstdInputStream::ReadSeekTable(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return nullptr;
+    }
+    file.seekg(0, std::ios::end);
+    uint64_t file_size = file.tellg();
+    if (file_size < 17) {
+        return nullptr;
+    }
+
+    // Footer: number of frames (4), descriptor (1), seekable magic (4)
+    uint8_t footer[9];
+    file.seekg(file_size - 9);
+    file.read(reinterpret_cast<char*>(footer), 9);
+    if (file.gcount() != 9 || LoadLittleEndian32(footer + 5) != ZSTD_SEEKABLE_MAGIC) {
+        return nullptr;
+    }
+    uint64_t frame_count = LoadLittleEndian32(footer);
+    bool has_checksums = (footer[4] & 0x80) != 0;
+    uint64_t entry_size = has_checksums ? 12 : 8;
+    uint64_t table_size = frame_count * entry_size;
+    if (table_size + 9 + 8 > file_size) {
+        return nullptr;
+    }
+
+    // The entries live in a skippable frame right before the footer
+    std::vector<uint8_t> table(table_size + 8);
+    file.seekg(file_size - 9 - table_size - 8);
+    file.read(reinterpret_cast<char*>(table.data()), table.size());
+    if (static_cast<uint64_t>(file.gcount()) != table.size() ||
+        LoadLittleEndian32(table.data()) != ZSTD_SKIPPABLE_SEEK_TABLE_MAGIC) {
+        return nullptr;
+    }
+
+    auto points = make_shared_ptr<std::vector<StataSeekPoint>>();
+    points->reserve(frame_count);
+    uint64_t compressed_offset = 0;
+    uint64_t uncompressed_offset = 0;
+    for (uint64_t i = 0; i < frame_count; i++) {
+        const uint8_t* entry = table.data() + 8 + i * entry_size;
+        points->push_back(StataSeekPoint {compressed_offset, uncompressed_offset});
+        compressed_offset += LoadLittleEndian32(entry);
+        uncompressed_offset += LoadLittleEndian32(entry + 4);
+    }
+    return points;
+}
+
+//===--------------------------------------------------------------------===//
+// StataTemporaryFile
+//===--------------------------------------------------------------------===//
+StataTemporaryFile::StataTemporaryFile(const std::string& directory) {
+    std::filesystem::path parent;
+    if (directory.empty()) {
+        parent = std::filesystem::temp_directory_path();
+    } else {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        parent = directory;
+    }
+    // Created exclusively under a random name, so a file left behind by another
+    // process, or planted in a shared directory, is never reused or truncated
+    auto path = (parent / "stata_dta_spill_XXXXXX").string();
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if (fd < 0) {
+        throw IOException("Cannot create temporary file in \"%s\": %s", parent.string(), strerror(errno));
+    }
+    close(fd);
+    path_ = name.data();
+}
+
+StataTemporaryFile::~StataTemporaryFile() {
+    std::remove(path_.c_str());
+}
+
+//===--------------------------------------------------------------------===//
+// Factory
+//===--------------------------------------------------------------------===//
+bool StataIsRegularFile(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    return S_ISREG(st.st_mode);
+}
+
+bool StataFileStamp(const std::string& path, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    size = static_cast<uint64_t>(st.st_size);
+    // In nanoseconds, so a file rewritten within the same second is still told apart
+#ifdef __APPLE__
+    mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+std::string StataAbsolutePath(const std::string& path) {
+    std::error_code error;
+    auto absolute = std::filesystem::absolute(path, error);
+    return error ? path : absolute.lexically_normal().string();
+}
+
+unique_ptr<StataInputStream> OpenStataInputStream(const std::string& path) {
+    auto raw = make_uniq<StataFileInputStream>(path);
+    bool seekable = raw->CanSeek();
+
+    // Peek at the magic bytes and push them back, so pipes are read exactly once
+    uint8_t magic[4] = {0, 0, 0, 0};
+    size_t magic_size = raw->Read(magic, sizeof(magic));
+    raw->Unread(magic, magic_size);
+
+    // Seek tables and indexes are only usable when the compressed file can be seeked
+    if (magic_size >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+        auto index = seekable ? StataGzipInputStream::ReadIndex(path) : nullptr;
+        return make_uniq<StataGzipInputStream>(path, std::move(raw), std::move(index));
+    }
+    if (magic_size == 4 && LoadLittleEndian32(magic) == 0xFD2FB528) {
+        auto seek_table = seekable ? StataZstdInputStream::ReadSeekTable(path) : nullptr;
+        return make_uniq<StataZstdInputStream>(path, std::move(raw), std::move(seek_table));
+    }
+    return std::move(raw);
+}
+
+} // namespace duckdb
@@ -0,0 +1,1354 @@
+#include "stata_writer.hpp"
+#include "duckdb/common/exception.hpp"
+#include "duckdb/common/string_util.hpp"
+#include "duckdb/common/vector_operations/vector_operations.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cctype>
+#include <ctime>
+#include <filesystem>
+#include <limits>
+#include <set>
+#include <type_traits>
+
+namespace duckdb {
+
+// Longest variable name Stata accepts
+static constexpr size_t STATA_MAX_NAME_LENGTH = 32;
+// Most variables a 117/118 file can hold; 119 lifts the limit
+static constexpr uint32_t STATA_MAX_VARIABLES = 32767;
+// Widest strN; longer strings are written as strL
+static constexpr idx_t STATA_MAX_STR_WIDTH = 2045;
+// strL contents kept for deduplication across blocks, without a shared budget
+static constexpr idx_t STATA_STRL_INDEX_SIZE = 64 * 1024 * 1024;
+// Rows converted per pass when widening the data section in place
+static constexpr idx_t STATA_RELAYOUT_BUFFER_SIZE = 8 * 1024 * 1024;
+
+// Missing value (.) of each storage type
+static constexpr int8_t STATA_MISSING_BYTE = 101;
+static constexpr int16_t STATA_MISSING_INT = 32741;
+static constexpr int32_t STATA_MISSING_LONG = 2147483621;
+
+static float StataMissingFloat() {
+    uint32_t bits = 0x7F000000; // 2^127
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static double StataMissingDouble() {
+    uint64_t bits = 0x7FE0000000000000ULL; // 2^1023
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Days and milliseconds from the Unix epoch to the Stata epoch, 1960-01-01
+static constexpr int32_t STATA_EPOCH_DAYS = 3653;
+static constexpr int64_t STATA_EPOCH_MILLIS = 315619200000LL;
+
+// Largest magnitude a Stata float can hold before the missing-value range
+static constexpr double STATA_MAX_FLOAT = 1.701e38;
+
+static bool NativeIsBigEndian() {
+    uint16_t test = 1;
+    return (*(uint8_t*)&test) == 0;
+}
+
+static uint64_t StorageSize(const StataColumnLayout& column) {
+    switch (column.type) {
+        case StataDataType::BYTE:
+            return 1;
+        case StataDataType::INT:
+            return 2;
+        case StataDataType::LONG:
+        case StataDataType::FLOAT:
+            return 4;
+        case StataDataType::DOUBLE:
+        case StataDataType::STRL:
+            return 8;
+        default:
+            return column.str_len;
+    }
+}
+
+void StataRowLayout::ComputeOffsets() {
+    offsets.clear();
+    row_size = 0;
+    for (const auto& column : columns) {
+        offsets.push_back(row_size);
+        row_size += StorageSize(column);
+    }
+}
+
+StataWriter::StataWriter(const std::string& filename, std::vector<StataWriterColumn> columns, uint16_t format_version,
+                         bool compress, std::vector<idx_t> sort_columns, shared_ptr<StataStrLBudget> strl_budget)
+    : filename_(filename), columns_(std::move(columns)), format_version_(format_version), compress_(compress),
+      is_big_endian_(NativeIsBigEndian()), rows_written_(0), nobs_position_(0), data_location_(0),
+      strl_budget_(std::move(strl_budget)), strl_index_bytes_(0), sort_columns_(std::move(sort_columns)), sort_holds_(!sort_columns_.empty()),
+      has_last_key_(false), last_numbers_(sort_columns_.size()), last_strings_(sort_columns_.size()) {
+    // Opened for reading too: rows are rewritten in place when the layout widens
+    file_.open(filename_, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file_.is_open()) {
+        throw IOException("Cannot create Stata file: " + filename_);
+    }
+
+    layout_ = InitialLayout();
+    if (!strl_budget_) {
+        strl_budget_ = make_shared_ptr<StataStrLBudget>(STATA_STRL_INDEX_SIZE);
+    }
+    strl_index_.resize(columns_.size());
+    WriteHeader();
+    data_location_ = GetPosition();
+    segments_.push_back(DataSegment {0, data_location_, layout_});
+}
+
+StataWriter::~StataWriter() {
+    strls_stream_.close();
+    ReleaseStrLIndex();
+}
+
+// Hands the strL contents kept for deduplication back to the shared budget
+void StataWriter::ReleaseStrLIndex() {
+    strl_budget_->Release(strl_index_bytes_);
+    strl_index_bytes_ = 0;
+    for (auto& index : strl_index_) {
+        index.clear();
+    }
+}
+
+// Plain numbers, which COMPRESS may store in any numeric type
+static bool IsCompressibleType(const LogicalType& type) {
+    switch (type.id()) {
+        case LogicalTypeId::BOOLEAN:
+        case LogicalTypeId::TINYINT:
+        case LogicalTypeId::UTINYINT:
+        case LogicalTypeId::SMALLINT:
+        case LogicalTypeId::USMALLINT:
+        case LogicalTypeId::INTEGER:
+        case LogicalTypeId::UINTEGER:
+        case LogicalTypeId::BIGINT:
+        case LogicalTypeId::UBIGINT:
+        case LogicalTypeId::HUGEINT:
+        case LogicalTypeId::UHUGEINT:
+        case LogicalTypeId::DECIMAL:
+        case LogicalTypeId::FLOAT:
+        case LogicalTypeId::DOUBLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The first length bytes of name, less the start of a UTF-8 character they would cut in half
+static std::string TruncateVariableName(const std::string& name, size_t length) {
+    if (name.size() <= length) {
+        return name;
+    }
+    // Back up while the first dropped byte continues the character before it
+    while (length > 0 && (static_cast<unsigned char>(name[length]) & 0xC0) == 0x80) {
+        length--;
+    }
+    return name.substr(0, length);
+}
+
+static std::string SanitizeVariableName(const std::string& name, uint16_t format_version) {
+    // Letters, digits and underscores, not starting with a digit. 118+ files are
+    // UTF-8 and also allow non-ASCII letters.
+    std::string result;
+    for (char c : name) {
+        auto byte = static_cast<unsigned char>(c);
+        bool valid = std::isalnum(byte) || c == '_' || (byte >= 0x80 && format_version >= 118);
+        result += valid ? c : '_';
+    }
+    if (result.empty() || std::isdigit(static_cast<unsigned char>(result[0]))) {
+        result = "_" + result;
+    }
+    return TruncateVariableName(result, STATA_MAX_NAME_LENGTH);
+}
+
+std::vector<StataWriterColumn> StataWriter::BindColumns(const vector<string>& names, const vector<LogicalType>& types,
+                                                        uint16_t format_version, bool compress) {
+    if (format_version < 119 && names.size() > STATA_MAX_VARIABLES) {
+        throw InvalidInputException("Stata format %d supports at most %d variables, use version 119 for %d",
+                                    format_version, STATA_MAX_VARIABLES, names.size());
+    }
+
+    std::vector<StataWriterColumn> columns;
+    std::set<std::string> used_names;
+    for (idx_t i = 0; i < names.size(); i++) {
+        StataWriterColumn column;
+        column.source_type = types[i];
+        column.str_len = 0;
+
+        // Stata has no 64-bit integers; wider integers are stored as double, exact up to 2^53
+        switch (types[i].id()) {
+            case LogicalTypeId::BOOLEAN:
+                column.type = StataDataType::BYTE;
+                break;
+            case LogicalTypeId::TINYINT:
+            case LogicalTypeId::UTINYINT:
+                // byte only holds -127 to 100
+                column.type = StataDataType::INT;
+                break;
+            case LogicalTypeId::SMALLINT:
+            case LogicalTypeId::USMALLINT:
+                // int only holds -32767 to 32740
+                column.type = StataDataType::LONG;
+                break;
+            case LogicalTypeId::FLOAT:
+                column.type = StataDataType::FLOAT;
+                break;
+            case LogicalTypeId::INTEGER:
+            case LogicalTypeId::UINTEGER:
+            case LogicalTypeId::BIGINT:
+            case LogicalTypeId::UBIGINT:
+            case LogicalTypeId::HUGEINT:
+            case LogicalTypeId::UHUGEINT:
+            case LogicalTypeId::DECIMAL:
+            case LogicalTypeId::DOUBLE:
+                column.type = StataDataType::DOUBLE;
+                break;
+            case LogicalTypeId::VARCHAR:
+                // Widened to the longest value while writing, strL beyond str2045
+                column.type = StataDataType::STR1_244;
+                column.str_len = 1;
+                break;
+            case LogicalTypeId::ENUM: {
+                // Codes 1..n with a value label table named after the variable
+                idx_t size = EnumType::GetSize(types[i]);
+                if (size <= 100) {
+                    column.type = StataDataType::BYTE;
+                } else if (size <= 32740) {
+                    column.type = StataDataType::INT;
+                } else {
+                    column.type = StataDataType::LONG;
+                }
+                auto& values = EnumType::GetValuesInsertOrder(types[i]);
+                auto strings = FlatVector::GetData<string_t>(values);
+                for (idx_t k = 0; k < size; k++) {
+                    column.value_labels.push_back(strings[k].GetString());
+                }
+                break;
+            }
+            case LogicalTypeId::DATE:
+                // %td: days since 1960-01-01
+                column.type = StataDataType::LONG;
+                break;
+            case LogicalTypeId::TIMESTAMP:
+            case LogicalTypeId::TIMESTAMP_TZ:
+            case LogicalTypeId::TIMESTAMP_SEC:
+            case LogicalTypeId::TIMESTAMP_MS:
+            case LogicalTypeId::TIMESTAMP_NS:
+                // %tc: milliseconds since 1960-01-01 00:00, exact in a double
+                column.type = StataDataType::DOUBLE;
+                break;
+            default:
+                throw NotImplementedException("Cannot write column \"%s\" of type %s to a Stata file", names[i],
+                                              types[i].ToString());
+        }
+        if (compress && IsCompressibleType(types[i])) {
+            // Like Stata's compress: start from byte and widen to what the values need
+            column.type = StataDataType::BYTE;
+        }
+
+        // Make names valid and unique
+        auto base_name = SanitizeVariableName(names[i], format_version);
+        column.name = base_name;
+        for (idx_t suffix = 1; used_names.count(column.name); suffix++) {
+            auto suffix_str = "_" + std::to_string(suffix);
+            column.name = TruncateVariableName(base_name, STATA_MAX_NAME_LENGTH - suffix_str.size()) + suffix_str;
+        }
+        used_names.insert(column.name);
+        columns.push_back(std::move(column));
+    }
+    return columns;
+}
+
+//===--------------------------------------------------------------------===//
+// Encoding
+//===--------------------------------------------------------------------===//
+size_t StataWriter::GetStrLVariableBytes() const {
+    // (v,o) is 4+4 bytes in format 117, 2+6 in 118 and 3+5 in 119
+    return format_version_ == 117 ? 4 : (format_version_ == 118 ? 2 : 3);
+}
+
+uint64_t StataWriter::MakeStrLReference(uint64_t v, uint64_t o) const {
+    // o is stored next to v, so shifting o later is a plain addition on the whole cell
+    size_t v_bits = 8 * GetStrLVariableBytes();
+    return is_big_endian_ ? (v << (64 - v_bits)) | o : v | (o << v_bits);
+}
+
+StataRowLayout StataWriter::InitialLayout() const {
+    StataRowLayout layout;
+    for (const auto& column : columns_) {
+        layout.columns.push_back(StataColumnLayout {column.type, column.str_len});
+    }
+    layout.ComputeOffsets();
+    return layout;
+}
+
+static bool IsNumericStorage(StataDataType type) {
+    return type != StataDataType::STR1_244 && type != StataDataType::STRL;
+}
+
+// Narrowest storage type that holds value exactly
+static StataDataType NarrowestNumericType(double value) {
+    if (value == std::floor(value)) {
+        if (value >= -127 && value <= 100) {
+            return StataDataType::BYTE;
+        }
+        if (value >= -32767 && value <= 32740) {
+            return StataDataType::INT;
+        }
+        if (value >= -2147483647.0 && value <= 2147483620.0) {
+            return StataDataType::LONG;
+        }
+    }
+    if (std::fabs(value) < STATA_MAX_FLOAT && static_cast<double>(static_cast<float>(value)) == value) {
+        return StataDataType::FLOAT;
+    }
+    return StataDataType::DOUBLE;
+}
+
+// Narrowest storage type that holds all values of both. byte < int < long and
+// int < float, but neither long nor float holds the other exactly.
+static StataDataType WiderNumericType(StataDataType a, StataDataType b) {
+    if (a == b) {
+        return a;
+    }
+    auto rank = [](StataDataType type) {
+        switch (type) {
+            case StataDataType::BYTE:
+                return 0;
+            case StataDataType::INT:
+                return 1;
+            case StataDataType::LONG:
+            case StataDataType::FLOAT:
+                return 2;
+            default:
+                return 3;
+        }
+    };
+    if (rank(a) == rank(b)) {
+        return StataDataType::DOUBLE;
+    }
+    return rank(a) > rank(b) ? a : b;
+}
+
+// Reads a numeric cell as double; false for missing
+static bool ReadNumericCell(StataDataType type, const uint8_t* cell, double& value) {
+    switch (type) {
+        case StataDataType::BYTE: {
+            int8_t v;
+            std::memcpy(&v, cell, sizeof(v));
+            value = v;
+            return v != STATA_MISSING_BYTE;
+        }
+        case StataDataType::INT: {
+            int16_t v;
+            std::memcpy(&v, cell, sizeof(v));
+            value = v;
+            return v != STATA_MISSING_INT;
+        }
+        case StataDataType::LONG: {
+            int32_t v;
+            std::memcpy(&v, cell, sizeof(v));
+            value = v;
+            return v != STATA_MISSING_LONG;
+        }
+        case StataDataType::FLOAT: {
+            float v;
+            std::memcpy(&v, cell, sizeof(v));
+            value = v;
+            return v != StataMissingFloat();
+        }
+        default: {
+            std::memcpy(&value, cell, sizeof(value));
+            return value != StataMissingDouble();
+        }
+    }
+}
+
+static void WriteNumericCell(StataDataType type, uint8_t* cell, double value, bool valid) {
+    switch (type) {
+        case StataDataType::BYTE: {
+            int8_t v = valid ? static_cast<int8_t>(value) : STATA_MISSING_BYTE;
+            std::memcpy(cell, &v, sizeof(v));
+            break;
+        }
+        case StataDataType::INT: {
+            int16_t v = valid ? static_cast<int16_t>(value) : STATA_MISSING_INT;
+            std::memcpy(cell, &v, sizeof(v));
+            break;
+        }
+        case StataDataType::LONG: {
+            int32_t v = valid ? static_cast<int32_t>(value) : STATA_MISSING_LONG;
+            std::memcpy(cell, &v, sizeof(v));
+            break;
+        }
+        case StataDataType::FLOAT: {
+            float v = valid ? static_cast<float>(value) : StataMissingFloat();
+            std::memcpy(cell, &v, sizeof(v));
+            break;
+        }
+        default: {
+            double v = valid ? value : StataMissingDouble();
+            std::memcpy(cell, &v, sizeof(v));
+            break;
+        }
+    }
+}
+
+StataRowLayout StataWriter::WidenLayout(const StataRowLayout& a, const StataRowLayout& b) {
+    StataRowLayout result = a;
+    for (idx_t col = 0; col < a.columns.size(); col++) {
+        auto& target = result.columns[col];
+        const auto& other = b.columns[col];
+        if (target == other) {
+            continue;
+        }
+        if (IsNumericStorage(target.type) && IsNumericStorage(other.type)) {
+            target.type = WiderNumericType(target.type, other.type);
+        } else if (target.type == StataDataType::STRL || other.type == StataDataType::STRL) {
+            target = StataColumnLayout {StataDataType::STRL, 0};
+        } else if (target.type == StataDataType::STR1_244 && other.type == StataDataType::STR1_244) {
+            target.str_len = std::max(target.str_len, other.str_len);
+        } else {
+            throw InternalException("Incompatible Stata storage types for the same column");
+        }
+    }
+    result.ComputeOffsets();
+    return result;
+}
+
+void StataWriter::ConvertRows(const uint8_t* src, const StataRowLayout& from, uint8_t* dst, const StataRowLayout& to,
+                              idx_t count, uint64_t first_o, std::vector<StataStrL>& strls) const {
+    for (idx_t col = 0; col < to.columns.size(); col++) {
+        const auto& source = from.columns[col];
+        const auto& target = to.columns[col];
+        const uint8_t* s = src + from.offsets[col];
+        uint8_t* d = dst + to.offsets[col];
+
+        if (source == target) {
+            uint64_t size = StorageSize(source);
+            for (idx_t row = 0; row < count; row++, s += from.row_size, d += to.row_size) {
+                std::memcpy(d, s, size);
+            }
+        } else if (source.type == StataDataType::STR1_244 && target.type == StataDataType::STR1_244) {
+            // Wider strN: pad with nulls
+            for (idx_t row = 0; row < count; row++, s += from.row_size, d += to.row_size) {
+                std::memcpy(d, s, source.str_len);
+                std::memset(d + source.str_len, 0, target.str_len - source.str_len);
+            }
+        } else if (source.type == StataDataType::STR1_244 && target.type == StataDataType::STRL) {
+            // strN to strL: each distinct non-empty value becomes a GSO
+            std::unordered_map<std::string, uint64_t> index;
+            for (idx_t row = 0; row < count; row++, s += from.row_size, d += to.row_size) {
+                auto end = static_cast<const uint8_t*>(std::memchr(s, '\0', source.str_len));
+                size_t length = end ? static_cast<size_t>(end - s) : source.str_len;
+                uint64_t reference = 0;
+                if (length > 0) {
+                    std::string value(reinterpret_cast<const char*>(s), length);
+                    auto entry = index.find(value);
+                    if (entry != index.end()) {
+                        reference = entry->second;
+                    } else {
+                        uint64_t o = first_o + row;
+                        reference = MakeStrLReference(col + 1, o);
+                        index.emplace(value, reference);
+                        strls.push_back(StataStrL {static_cast<uint32_t>(col + 1), o, std::move(value)});
+                    }
+                }
+                std::memcpy(d, &reference, sizeof(reference));
+            }
+        } else if (IsNumericStorage(source.type) && IsNumericStorage(target.type)) {
+            // Wider numeric type: values and missing values both carry over
+            for (idx_t row = 0; row < count; row++, s += from.row_size, d += to.row_size) {
+                double value;
+                bool valid = ReadNumericCell(source.type, s, value);
+                WriteNumericCell(target.type, d, value, valid);
+            }
+        } else {
+            throw InternalException("Unsupported Stata storage type conversion");
+        }
+    }
+}
+
+template <class SRC, class DST>
+static void EncodeNumericColumn(UnifiedVectorFormat& vdata, idx_t count, uint8_t* dest, uint64_t row_size,
+                                DST missing) {
+    auto src = UnifiedVectorFormat::GetData<SRC>(vdata);
+    for (idx_t row = 0; row < count; row++, dest += row_size) {
+        auto idx = vdata.sel->get_index(row);
+        DST value = missing;
+        if (vdata.validity.RowIsValid(idx)) {
+            if constexpr (std::is_floating_point<SRC>::value) {
+                if (!std::isnan(src[idx])) {
+                    value = static_cast<DST>(src[idx]);
+                }
+            } else {
+                value = static_cast<DST>(src[idx]);
+            }
+        }
+        std::memcpy(dest, &value, sizeof(DST));
+    }
+}
+
+// Encodes doubles into whichever numeric storage type the layout chose
+static void EncodeCompressedColumn(Vector& values, idx_t count, uint8_t* dest, uint64_t row_size, StataDataType type) {
+    UnifiedVectorFormat vdata;
+    values.ToUnifiedFormat(count, vdata);
+    switch (type) {
+        case StataDataType::BYTE:
+            EncodeNumericColumn<double, int8_t>(vdata, count, dest, row_size, STATA_MISSING_BYTE);
+            break;
+        case StataDataType::INT:
+            EncodeNumericColumn<double, int16_t>(vdata, count, dest, row_size, STATA_MISSING_INT);
+            break;
+        case StataDataType::LONG:
+            EncodeNumericColumn<double, int32_t>(vdata, count, dest, row_size, STATA_MISSING_LONG);
+            break;
+        case StataDataType::FLOAT:
+            EncodeNumericColumn<double, float>(vdata, count, dest, row_size, StataMissingFloat());
+            break;
+        default:
+            EncodeNumericColumn<double, double>(vdata, count, dest, row_size, StataMissingDouble());
+            break;
+    }
+}
+
+// Encodes values that need a conversion, such as dates to the Stata epoch.
+// convert returns false for values that are written as missing.
+template <class SRC, class DST, class OP>
+static void EncodeConvertedColumn(UnifiedVectorFormat& vdata, idx_t count, uint8_t* dest, uint64_t row_size,
+                                  DST missing, OP convert) {
+    auto src = UnifiedVectorFormat::GetData<SRC>(vdata);
+    for (idx_t row = 0; row < count; row++, dest += row_size) {
+        auto idx = vdata.sel->get_index(row);
+        DST value;
+        if (!vdata.validity.RowIsValid(idx) || !convert(src[idx], value)) {
+            value = missing;
+        }
+        std::memcpy(dest, &value, sizeof(DST));
+    }
+}
+
+static int64_t FloorDivide(int64_t value, int64_t divisor) {
+    int64_t result = value / divisor;
+    return (value % divisor != 0 && value < 0) ? result - 1 : result;
+}
+
+template <class SRC, class DST>
+static void EncodeEnumColumn(UnifiedVectorFormat& vdata, idx_t count, uint8_t* dest, uint64_t row_size, DST missing) {
+    EncodeConvertedColumn<SRC, DST>(vdata, count, dest, row_size, missing, [](SRC index, DST& value) {
+        value = static_cast<DST>(index + 1);
+        return true;
+    });
+}
+
+template <class DST>
+static void EncodeEnumCodes(PhysicalType physical_type, UnifiedVectorFormat& vdata, idx_t count, uint8_t* dest,
+                            uint64_t row_size, DST missing) {
+    switch (physical_type) {
+        case PhysicalType::UINT8:
+            EncodeEnumColumn<uint8_t, DST>(vdata, count, dest, row_size, missing);
+            break;
+        case PhysicalType::UINT16:
+            EncodeEnumColumn<uint16_t, DST>(vdata, count, dest, row_size, missing);
+            break;
+        default:
+            EncodeEnumColumn<uint32_t, DST>(vdata, count, dest, row_size, missing);
+            break;
+    }
+}
+
+// Milliseconds since the Stata epoch; unit is the length of one source tick in nanoseconds
+static void EncodeTimestampColumn(UnifiedVectorFormat& vdata, idx_t count, uint8_t* dest, uint64_t row_size,
+                                  int64_t unit) {
+    EncodeConvertedColumn<timestamp_t, double>(vdata, count, dest, row_size, StataMissingDouble(),
+                                               [unit](timestamp_t timestamp, double& value) {
+                                                   if (!Timestamp::IsFinite(timestamp)) {
+                                                       return false;
+                                                   }
+                                                   int64_t millis = unit >= 1000000
+                                                                        ? timestamp.value * (unit / 1000000)
+                                                                        : FloorDivide(timestamp.value, 1000000 / unit);
+                                                   value = static_cast<double>(millis + STATA_EPOCH_MILLIS);
+                                                   return true;
+                                               });
+}
+
+void StataWriter::EncodeColumn(const StataWriterColumn& column, idx_t col_idx, Vector& source, idx_t count,
+                               uint8_t* dest, StataRowBlock& block) const {
+    UnifiedVectorFormat vdata;
+    source.ToUnifiedFormat(count, vdata);
+    uint64_t row_size = block.layout.row_size;
+
+    switch (column.source_type.id()) {
+        case LogicalTypeId::BOOLEAN:
+            EncodeNumericColumn<bool, int8_t>(vdata, count, dest, row_size, STATA_MISSING_BYTE);
+            break;
+        case LogicalTypeId::TINYINT:
+            EncodeNumericColumn<int8_t, int16_t>(vdata, count, dest, row_size, STATA_MISSING_INT);
+            break;
+        case LogicalTypeId::UTINYINT:
+            EncodeNumericColumn<uint8_t, int16_t>(vdata, count, dest, row_size, STATA_MISSING_INT);
+            break;
+        case LogicalTypeId::SMALLINT:
+            EncodeNumericColumn<int16_t, int32_t>(vdata, count, dest, row_size, STATA_MISSING_LONG);
+            break;
+        case LogicalTypeId::USMALLINT:
+            EncodeNumericColumn<uint16_t, int32_t>(vdata, count, dest, row_size, STATA_MISSING_LONG);
+            break;
+        case LogicalTypeId::INTEGER:
+            EncodeNumericColumn<int32_t, double>(vdata, count, dest, row_size, StataMissingDouble());
+            break;
+        case LogicalTypeId::UINTEGER:
+            EncodeNumericColumn<uint32_t, double>(vdata, count, dest, row_size, StataMissingDouble());
+            break;
+        case LogicalTypeId::BIGINT:
+            EncodeNumericColumn<int64_t, double>(vdata, count, dest, row_size, StataMissingDouble());
+            break;
+        case LogicalTypeId::UBIGINT:
+            EncodeNumericColumn<uint64_t, double>(vdata, count, dest, row_size, StataMissingDouble());
+            break;
+        case LogicalTypeId::FLOAT:
+            EncodeNumericColumn<float, float>(vdata, count, dest, row_size, StataMissingFloat());
+            break;
+        case LogicalTypeId::DOUBLE:
+            EncodeNumericColumn<double, double>(vdata, count, dest, row_size, StataMissingDouble());
+            break;
+        case LogicalTypeId::ENUM: {
+            auto physical_type = column.source_type.InternalType();
+            switch (column.type) {
+                case StataDataType::BYTE:
+                    EncodeEnumCodes<int8_t>(physical_type, vdata, count, dest, row_size, STATA_MISSING_BYTE);
+                    break;
+                case StataDataType::INT:
+                    EncodeEnumCodes<int16_t>(physical_type, vdata, count, dest, row_size, STATA_MISSING_INT);
+                    break;
+                default:
+                    EncodeEnumCodes<int32_t>(physical_type, vdata, count, dest, row_size, STATA_MISSING_LONG);
+                    break;
+            }
+            break;
+        }
+        case LogicalTypeId::DATE:
+            EncodeConvertedColumn<date_t, int32_t>(vdata, count, dest, row_size, STATA_MISSING_LONG,
+                                                   [](date_t date, int32_t& value) {
+                                                       if (!Date::IsFinite(date)) {
+                                                           return false;
+                                                       }
+                                                       value = date.days + STATA_EPOCH_DAYS;
+                                                       return true;
+                                                   });
+            break;
+        case LogicalTypeId::TIMESTAMP_SEC:
+            EncodeTimestampColumn(vdata, count, dest, row_size, 1000000000);
+            break;
+        case LogicalTypeId::TIMESTAMP_MS:
+            EncodeTimestampColumn(vdata, count, dest, row_size, 1000000);
+            break;
+        case LogicalTypeId::TIMESTAMP:
+        case LogicalTypeId::TIMESTAMP_TZ:
+            EncodeTimestampColumn(vdata, count, dest, row_size, 1000);
+            break;
+        case LogicalTypeId::TIMESTAMP_NS:
+            EncodeTimestampColumn(vdata, count, dest, row_size, 1);
+            break;
+        case LogicalTypeId::HUGEINT:
+        case LogicalTypeId::UHUGEINT:
+        case LogicalTypeId::DECIMAL: {
+            Vector doubles(LogicalType::DOUBLE, count);
+            VectorOperations::DefaultCast(source, doubles, count);
+            EncodeColumn(StataWriterColumn {column.name, LogicalType::DOUBLE, column.type, 0}, col_idx, doubles,
+                         count, dest, block);
+            break;
+        }
+        case LogicalTypeId::VARCHAR: {
+            auto src = UnifiedVectorFormat::GetData<string_t>(vdata);
+            const auto& layout = block.layout.columns[col_idx];
+            if (layout.type == StataDataType::STRL) {
+                // Rows reference their value by (v,o); o is relative to the block until WriteBlock.
+                // Repeated values share the GSO of their first occurrence.
+                block.strl_index.resize(columns_.size());
+                auto& index = block.strl_index[col_idx];
+                for (idx_t row = 0; row < count; row++, dest += row_size) {
+                    auto idx = vdata.sel->get_index(row);
+                    uint64_t reference = 0; // (0,0): empty string
+                    if (vdata.validity.RowIsValid(idx) && src[idx].GetSize() > 0) {
+                        auto value = src[idx].GetString();
+                        auto entry = index.find(value);
+                        if (entry != index.end()) {
+                            reference = entry->second;
+                        } else {
+                            uint64_t o = block.count + row + 1;
+                            reference = MakeStrLReference(col_idx + 1, o);
+                            index.emplace(value, reference);
+                            block.strls.push_back(StataStrL {static_cast<uint32_t>(col_idx + 1), o, std::move(value)});
+                        }
+                    }
+                    std::memcpy(dest, &reference, sizeof(reference));
+                }
+            } else {
+                // strN: null-padded to the column width, which EncodeChunk made wide enough
+                for (idx_t row = 0; row < count; row++, dest += row_size) {
+                    auto idx = vdata.sel->get_index(row);
+                    size_t length = vdata.validity.RowIsValid(idx) ? src[idx].GetSize() : 0;
+                    if (length > 0) {
+                        std::memcpy(dest, src[idx].GetData(), length);
+                    }
+                    std::memset(dest + length, 0, layout.str_len - length);
+                }
+            }
+            break;
+        }
+        default:
+            throw NotImplementedException("Cannot write type %s to a Stata file", column.source_type.ToString());
+    }
+}
+
+void StataWriter::EncodeChunk(DataChunk& chunk, StataRowBlock& block) const {
+    idx_t count = chunk.size();
+    if (count == 0) {
+        return;
+    }
+    if (block.layout.columns.empty()) {
+        block.layout = InitialLayout();
+    }
+
+    // Widen string columns to the longest value in the chunk. With compress,
+    // numeric columns are encoded from doubles and widened to the narrowest
+    // type that holds every value.
+    StataRowLayout required = block.layout;
+    vector<unique_ptr<Vector>> casts(columns_.size());
+    vector<Vector*> compressed(columns_.size(), nullptr);
+    for (idx_t col = 0; col < columns_.size(); col++) {
+        auto& layout = required.columns[col];
+        if (compress_ && IsCompressibleType(columns_[col].source_type)) {
+            compressed[col] = &chunk.data[col];
+            if (columns_[col].source_type.id() != LogicalTypeId::DOUBLE) {
+                casts[col] = make_uniq<Vector>(LogicalType::DOUBLE, count);
+                VectorOperations::DefaultCast(chunk.data[col], *casts[col], count);
+                compressed[col] = casts[col].get();
+            }
+            UnifiedVectorFormat vdata;
+            compressed[col]->ToUnifiedFormat(count, vdata);
+            auto src = UnifiedVectorFormat::GetData<double>(vdata);
+            for (idx_t row = 0; row < count && layout.type != StataDataType::DOUBLE; row++) {
+                auto idx = vdata.sel->get_index(row);
+                if (vdata.validity.RowIsValid(idx) && !std::isnan(src[idx])) {
+                    layout.type = WiderNumericType(layout.type, NarrowestNumericType(src[idx]));
+                }
+            }
+            continue;
+        }
+        if (columns_[col].source_type.id() != LogicalTypeId::VARCHAR || layout.type == StataDataType::STRL) {
+            continue;
+        }
+        UnifiedVectorFormat vdata;
+        chunk.data[col].ToUnifiedFormat(count, vdata);
+        auto src = UnifiedVectorFormat::GetData<string_t>(vdata);
+        idx_t max_length = 0;
+        for (idx_t row = 0; row < count; row++) {
+            auto idx = vdata.sel->get_index(row);
+            if (vdata.validity.RowIsValid(idx)) {
+                max_length = MaxValue<idx_t>(max_length, src[idx].GetSize());
+            }
+        }
+        if (max_length > STATA_MAX_STR_WIDTH) {
+            layout = StataColumnLayout {StataDataType::STRL, 0};
+        } else if (max_length > layout.str_len) {
+            layout.str_len = static_cast<uint16_t>(max_length);
+        }
+    }
+    if (required != block.layout) {
+        required.ComputeOffsets();
+        if (block.count > 0) {
+            std::vector<uint8_t> rows(block.count * required.row_size);
+            ConvertRows(block.rows.data(), block.layout, rows.data(), required, block.count, 1, block.strls);
+            block.rows = std::move(rows);
+        }
+        block.layout = std::move(required);
+    }
+
+    size_t start = block.rows.size();
+    block.rows.resize(start + count * block.layout.row_size);
+    uint8_t* rows = block.rows.data() + start;
+    for (idx_t col = 0; col < columns_.size(); col++) {
+        uint8_t* dest = rows + block.layout.offsets[col];
+        if (compressed[col]) {
+            EncodeCompressedColumn(*compressed[col], count, dest, block.layout.row_size, block.layout.columns[col].type);
+        } else {
+            EncodeColumn(columns_[col], col, chunk.data[col], count, dest, block);
+        }
+    }
+    block.count += count;
+}
+
+//===--------------------------------------------------------------------===//
+// File output
+//===--------------------------------------------------------------------===//
+void StataWriter::WriteBytes(const void* data, size_t length) {
+    file_.write(reinterpret_cast<const char*>(data), length);
+}
+
+template <class T>
+void StataWriter::WriteValue(T value) {
+    // Files are written in native byte order, recorded in <byteorder>
+    WriteBytes(&value, sizeof(T));
+}
+
+void StataWriter::WriteTag(const std::string& tag) {
+    WriteBytes(tag.data(), tag.size());
+}
+
+void StataWriter::WriteFixedWidthString(const std::string& value, size_t width) {
+    std::vector<char> buffer(width, '\0');
+    // Keep at least one terminating null
+    std::memcpy(buffer.data(), value.data(), std::min(value.size(), width - 1));
+    WriteBytes(buffer.data(), width);
+}
+
+void StataWriter::WriteObsCount(uint64_t nobs) {
+    if (format_version_ >= 118) {
+        WriteValue<uint64_t>(nobs);
+    } else {
+        WriteValue<uint32_t>(static_cast<uint32_t>(nobs));
+    }
+}
+
+uint64_t StataWriter::GetPosition() {
+    return static_cast<uint64_t>(file_.tellp());
+}
+
+void StataWriter::WriteVariableTypes() {
+    for (const auto& column : layout_.columns) {
+        switch (column.type) {
+            case StataDataType::BYTE:
+                WriteValue<uint16_t>(65530);
+                break;
+            case StataDataType::INT:
+                WriteValue<uint16_t>(65529);
+                break;
+            case StataDataType::LONG:
+                WriteValue<uint16_t>(65528);
+                break;
+            case StataDataType::FLOAT:
+                WriteValue<uint16_t>(65527);
+                break;
+            case StataDataType::DOUBLE:
+                WriteValue<uint16_t>(65526);
+                break;
+            case StataDataType::STRL:
+                WriteValue<uint16_t>(32768);
+                break;
+            default:
+                WriteValue<uint16_t>(column.str_len);
+                break;
+        }
+    }
+}
+
+void StataWriter::WriteFormats() {
+    size_t format_length = (format_version_ >= 118) ? 57 : 49;
+    for (idx_t col = 0; col < layout_.columns.size(); col++) {
+        const auto& column = layout_.columns[col];
+        auto source_type = columns_[col].source_type.id();
+        if (source_type == LogicalTypeId::DATE) {
+            WriteFixedWidthString("%td", format_length);
+            continue;
+        }
+        if (source_type == LogicalTypeId::TIMESTAMP || source_type == LogicalTypeId::TIMESTAMP_TZ ||
+            source_type == LogicalTypeId::TIMESTAMP_SEC || source_type == LogicalTypeId::TIMESTAMP_MS ||
+            source_type == LogicalTypeId::TIMESTAMP_NS) {
+            WriteFixedWidthString("%tc", format_length);
+            continue;
+        }
+        switch (column.type) {
+            case StataDataType::BYTE:
+            case StataDataType::INT:
+                WriteFixedWidthString("%8.0g", format_length);
+                break;
+            case StataDataType::LONG:
+                WriteFixedWidthString("%12.0g", format_length);
+                break;
+            case StataDataType::FLOAT:
+                WriteFixedWidthString("%9.0g", format_length);
+                break;
+            case StataDataType::DOUBLE:
+                WriteFixedWidthString("%10.0g", format_length);
+                break;
+            case StataDataType::STRL:
+                WriteFixedWidthString("%9s", format_length);
+                break;
+            default:
+                WriteFixedWidthString("%" + std::to_string(column.str_len) + "s", format_length);
+                break;
+        }
+    }
+}
+
+// Drops strLs whose contents were already written for the same variable and
+// points their cells at the earlier GSO. rows hold absolute references.
+void StataWriter::DeduplicateStrLs(std::vector<StataStrL>& strls, uint64_t o_offset, uint8_t* rows,
+                                   const StataRowLayout& layout, idx_t count) {
+    std::unordered_map<uint64_t, uint64_t> remap;
+    idx_t kept = 0;
+    for (idx_t i = 0; i < strls.size(); i++) {
+        auto& strl = strls[i];
+        uint64_t reference = MakeStrLReference(strl.v, strl.o + o_offset);
+        auto& index = strl_index_[strl.v - 1];
+        auto entry = index.find(strl.contents);
+        if (entry != index.end()) {
+            remap[reference] = entry->second;
+            continue;
+        }
+        if (strl_budget_->Reserve(strl.contents.size())) {
+            strl_index_bytes_ += strl.contents.size();
+            index.emplace(strl.contents, reference);
+        }
+        if (kept != i) {
+            strls[kept] = std::move(strl);
+        }
+        kept++;
+    }
+    strls.resize(kept);
+    if (remap.empty()) {
+        return;
+    }
+
+    for (idx_t col = 0; col < layout.columns.size(); col++) {
+        if (layout.columns[col].type != StataDataType::STRL) {
+            continue;
+        }
+        uint8_t* cell = rows + layout.offsets[col];
+        for (idx_t row = 0; row < count; row++, cell += layout.row_size) {
+            uint64_t reference;
+            std::memcpy(&reference, cell, sizeof(reference));
+            auto entry = remap.find(reference);
+            if (entry != remap.end()) {
+                std::memcpy(cell, &entry->second, sizeof(entry->second));
+            }
+        }
+    }
+}
+
+void StataWriter::WriteStrLs(const std::vector<StataStrL>& strls, uint64_t o_offset) {
+    if (strls.empty()) {
+        return;
+    }
+    if (!strls_file_) {
+        strls_file_ = make_uniq<StataTemporaryFile>();
+        strls_stream_.open(strls_file_->GetPath(), std::ios::binary | std::ios::trunc);
+        if (!strls_stream_.is_open()) {
+            throw IOException("Cannot create temporary file for Stata strLs: " + strls_file_->GetPath());
+        }
+    }
+
+    // GSO entries: "GSO", v, o, type 130 (null-terminated ASCII/UTF-8), length, contents
+    for (auto& strl : strls) {
+        uint64_t o = strl.o + o_offset;
+        uint32_t length = static_cast<uint32_t>(strl.contents.size() + 1);
+        strls_stream_.write("GSO", 3);
+        strls_stream_.write(reinterpret_cast<const char*>(&strl.v), sizeof(strl.v));
+        if (format_version_ >= 118) {
+            strls_stream_.write(reinterpret_cast<const char*>(&o), sizeof(o));
+        } else {
+            auto o32 = static_cast<uint32_t>(o);
+            strls_stream_.write(reinterpret_cast<const char*>(&o32), sizeof(o32));
+        }
+        uint8_t type = 130;
+        strls_stream_.write(reinterpret_cast<const char*>(&type), sizeof(type));
+        strls_stream_.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        strls_stream_.write(strl.contents.c_str(), length);
+    }
+    if (!strls_stream_) {
+        throw IOException("Failed to write temporary file for Stata strLs: " + strls_file_->GetPath());
+    }
+}
+
+void StataWriter::WriteSortList() {
+    // 1-based variable numbers, zero-terminated, nvar + 1 entries in total
+    for (idx_t i = 0; i <= columns_.size(); i++) {
+        uint32_t variable = i < sort_columns_.size() ? static_cast<uint32_t>(sort_columns_[i] + 1) : 0;
+        if (format_version_ >= 119) {
+            WriteValue<uint32_t>(variable);
+        } else {
+            WriteValue<uint16_t>(static_cast<uint16_t>(variable));
+        }
+    }
+}
+
+void StataWriter::WriteValueLabels() {
+    size_t name_length = (format_version_ >= 118) ? 129 : 33;
+    for (const auto& column : columns_) {
+        if (column.value_labels.empty()) {
+            continue;
+        }
+        // Table: n, txtlen, off[n], val[n], then the null-terminated labels
+        uint32_t n = static_cast<uint32_t>(column.value_labels.size());
+        std::vector<uint32_t> offsets;
+        std::string text;
+        for (const auto& label : column.value_labels) {
+            offsets.push_back(static_cast<uint32_t>(text.size()));
+            text += label;
+            text += '\0';
+        }
+        WriteTag("<lbl>");
+        WriteValue<uint32_t>(static_cast<uint32_t>(8 + 8 * n + text.size()));
+        WriteFixedWidthString(column.name, name_length);
+        WriteBytes("\0\0\0", 3);
+        WriteValue<uint32_t>(n);
+        WriteValue<uint32_t>(static_cast<uint32_t>(text.size()));
+        for (auto offset : offsets) {
+            WriteValue<uint32_t>(offset);
+        }
+        for (uint32_t code = 1; code <= n; code++) {
+            WriteValue<int32_t>(static_cast<int32_t>(code));
+        }
+        WriteBytes(text.data(), text.size());
+        WriteTag("</lbl>");
+    }
+}
+
+void StataWriter::WriteHeader() {
+    section_map_.assign(14, 0);
+    uint32_t nvar = static_cast<uint32_t>(columns_.size());
+    size_t name_length = (format_version_ >= 118) ? 129 : 33;
+    size_t label_length = (format_version_ >= 118) ? 321 : 81;
+
+    WriteTag("<stata_dta><header>");
+    WriteTag("<release>" + std::to_string(format_version_) + "</release>");
+    WriteTag(is_big_endian_ ? "<byteorder>MSF</byteorder>" : "<byteorder>LSF</byteorder>");
+
+    WriteTag("<K>");
+    if (format_version_ >= 119) {
+        WriteValue<uint32_t>(nvar);
+    } else {
+        WriteValue<uint16_t>(static_cast<uint16_t>(nvar));
+    }
+    WriteTag("</K>");
+
+    // The observation count is patched in Finish
+    WriteTag("<N>");
+    nobs_position_ = GetPosition();
+    WriteObsCount(0);
+    WriteTag("</N>");
+
+    WriteTag("<label>");
+    if (format_version_ >= 118) {
+        WriteValue<uint16_t>(0);
+    } else {
+        WriteValue<uint8_t>(0);
+    }
+    WriteTag("</label>");
+
+    char timestamp[32];
+    std::time_t now = std::time(nullptr);
+    // std::localtime returns a shared buffer; several COPY threads write headers at once
+    std::tm local_time {};
+#ifdef _WIN32
+    localtime_s(&local_time, &now);
+#else
+    localtime_r(&now, &local_time);
+#endif
+    size_t timestamp_length = std::strftime(timestamp, sizeof(timestamp), "%d %b %Y %H:%M", &local_time);
+    WriteTag("<timestamp>");
+    WriteValue<uint8_t>(static_cast<uint8_t>(timestamp_length));
+    WriteBytes(timestamp, timestamp_length);
+    WriteTag("</timestamp></header>");
+
+    // Section offsets, variable types and formats are patched in Finish
+    section_map_[1] = GetPosition();
+    WriteTag("<map>");
+    for (auto offset : section_map_) {
+        WriteValue<uint64_t>(offset);
+    }
+    WriteTag("</map>");
+
+    section_map_[2] = GetPosition();
+    WriteTag("<variable_types>");
+    WriteVariableTypes();
+    WriteTag("</variable_types>");
+
+    section_map_[3] = GetPosition();
+    WriteTag("<varnames>");
+    for (const auto& column : columns_) {
+        WriteFixedWidthString(column.name, name_length);
+    }
+    WriteTag("</varnames>");
+
+    // Empty sort list (nvar + 1 zero entries), patched in Finish if the rows were sorted
+    section_map_[4] = GetPosition();
+    WriteTag("<sortlist>");
+    std::vector<uint8_t> sortlist((nvar + 1) * (format_version_ >= 119 ? 4 : 2), 0);
+    WriteBytes(sortlist.data(), sortlist.size());
+    WriteTag("</sortlist>");
+
+    section_map_[5] = GetPosition();
+    WriteTag("<formats>");
+    WriteFormats();
+    WriteTag("</formats>");
+
+    section_map_[6] = GetPosition();
+    WriteTag("<value_label_names>");
+    for (const auto& column : columns_) {
+        WriteFixedWidthString(column.value_labels.empty() ? "" : column.name, name_length);
+    }
+    WriteTag("</value_label_names>");
+
+    section_map_[7] = GetPosition();
+    WriteTag("<variable_labels>");
+    for (idx_t i = 0; i < columns_.size(); i++) {
+        WriteFixedWidthString("", label_length);
+    }
+    WriteTag("</variable_labels>");
+
+    section_map_[8] = GetPosition();
+    WriteTag("<characteristics></characteristics>");
+
+    section_map_[9] = GetPosition();
+    WriteTag("<data>");
+}
+
+void StataWriter::WriteBlock(StataRowBlock& block) {
+    if (block.count == 0) {
+        return;
+    }
+
+    // Widen the file layout to fit the block; later rows start a new segment
+    auto widened = WidenLayout(layout_, block.layout);
+    if (widened != layout_) {
+        layout_ = std::move(widened);
+        if (segments_.back().first_row == rows_written_) {
+            segments_.back().layout = layout_;
+        } else {
+            segments_.push_back(DataSegment {rows_written_, GetPosition(), layout_});
+        }
+    }
+    if (block.layout != layout_) {
+        std::vector<uint8_t> rows(block.count * layout_.row_size);
+        ConvertRows(block.rows.data(), block.layout, rows.data(), layout_, block.count, 1, block.strls);
+        block.rows = std::move(rows);
+        block.layout = layout_;
+    }
+
+    // Make strL references absolute now that the first row of the block is known
+    uint64_t o_shift = MakeStrLReference(0, rows_written_);
+    for (idx_t col = 0; col < layout_.columns.size(); col++) {
+        if (layout_.columns[col].type != StataDataType::STRL) {
+            continue;
+        }
+        uint8_t* cell = block.rows.data() + layout_.offsets[col];
+        for (idx_t row = 0; row < block.count; row++, cell += layout_.row_size) {
+            uint64_t reference;
+            std::memcpy(&reference, cell, sizeof(reference));
+            if (reference != 0) {
+                reference += o_shift;
+                std::memcpy(cell, &reference, sizeof(reference));
+            }
+        }
+    }
+    CheckSortOrder(block);
+    DeduplicateStrLs(block.strls, rows_written_, block.rows.data(), layout_, block.count);
+    WriteBytes(block.rows.data(), block.rows.size());
+    WriteStrLs(block.strls, rows_written_);
+
+    rows_written_ += block.count;
+    if (!file_) {
+        throw IOException("Failed to write Stata file: " + filename_);
+    }
+}
+
+// Compares each row's sort key with the previous row's. Stata sorts missing
+// values after all numbers and strings bytewise.
+void StataWriter::CheckSortOrder(const StataRowBlock& block) {
+    if (!sort_holds_) {
+        return;
+    }
+    std::vector<double> numbers(sort_columns_.size());
+    std::vector<std::string> strings(sort_columns_.size());
+    const uint8_t* row = block.rows.data();
+    for (idx_t r = 0; r < block.count; r++, row += layout_.row_size) {
+        int comparison = 0;
+        for (idx_t k = 0; k < sort_columns_.size(); k++) {
+            auto col = sort_columns_[k];
+            const auto& column = layout_.columns[col];
+            const uint8_t* cell = row + layout_.offsets[col];
+            if (column.type == StataDataType::STRL) {
+                // Only references are at hand here
+                sort_holds_ = false;
+                return;
+            }
+            if (column.type == StataDataType::STR1_244) {
+                auto end = static_cast<const uint8_t*>(std::memchr(cell, '\0', column.str_len));
+                size_t length = end ? static_cast<size_t>(end - cell) : column.str_len;
+                strings[k].assign(reinterpret_cast<const char*>(cell), length);
+                if (comparison == 0 && has_last_key_) {
+                    comparison = strings[k].compare(last_strings_[k]);
+                }
+            } else {
+                double value;
+                if (!ReadNumericCell(column.type, cell, value)) {
+                    value = std::numeric_limits<double>::infinity();
+                }
+                numbers[k] = value;
+                if (comparison == 0 && has_last_key_) {
+                    comparison = value < last_numbers_[k] ? -1 : (value > last_numbers_[k] ? 1 : 0);
+                }
+            }
+        }
+        if (comparison < 0) {
+            sort_holds_ = false;
+            return;
+        }
+        std::swap(numbers, last_numbers_);
+        std::swap(strings, last_strings_);
+        has_last_key_ = true;
+    }
+}
+
+void StataWriter::ReadSegmentRows(const DataSegment& segment, uint64_t first, idx_t count,
+                                  std::vector<uint8_t>& target) {
+    std::vector<uint8_t> source(count * segment.layout.row_size);
+    file_.seekg(segment.file_offset + first * segment.layout.row_size);
+    file_.read(reinterpret_cast<char*>(source.data()), source.size());
+
+    std::vector<StataStrL> strls;
+    target.resize(count * layout_.row_size);
+    ConvertRows(source.data(), segment.layout, target.data(), layout_, count, segment.first_row + first + 1, strls);
+    DeduplicateStrLs(strls, 0, target.data(), layout_, count);
+    WriteStrLs(strls, 0);
+}
+
+void StataWriter::RelayoutData() {
+    uint64_t row_size = layout_.row_size;
+    idx_t rows_per_pass = MaxValue<idx_t>(1, STATA_RELAYOUT_BUFFER_SIZE / MaxValue<uint64_t>(row_size, 1));
+    std::vector<uint8_t> target;
+
+    bool rows_shrink = false;
+    for (const auto& segment : segments_) {
+        rows_shrink = rows_shrink || segment.layout.row_size > row_size;
+    }
+    if (rows_shrink) {
+        // A wide strN column that became strL makes rows shorter, so rows move in
+        // both directions. Convert through a temporary file and copy the result back.
+        StataTemporaryFile converted;
+        std::fstream temp(converted.GetPath(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!temp.is_open()) {
+            throw IOException("Cannot create temporary file for Stata data: " + converted.GetPath());
+        }
+        for (idx_t seg_idx = 0; seg_idx < segments_.size(); seg_idx++) {
+            const auto& segment = segments_[seg_idx];
+            uint64_t end_row = seg_idx + 1 < segments_.size() ? segments_[seg_idx + 1].first_row : rows_written_;
+            for (uint64_t first = 0; first < end_row - segment.first_row; first += rows_per_pass) {
+                idx_t count = MinValue<idx_t>(end_row - segment.first_row - first, rows_per_pass);
+                ReadSegmentRows(segment, first, count, target);
+                temp.write(reinterpret_cast<const char*>(target.data()), target.size());
+            }
+        }
+        temp.seekg(0);
+        file_.seekp(data_location_);
+        target.resize(rows_per_pass * row_size);
+        while (temp.read(reinterpret_cast<char*>(target.data()), target.size()) || temp.gcount() > 0) {
+            WriteBytes(target.data(), static_cast<size_t>(temp.gcount()));
+        }
+        if (!file_ || temp.bad()) {
+            throw IOException("Failed to write Stata file: " + filename_);
+        }
+        return;
+    }
+
+    // Otherwise rows only move towards the end of the file. Going back to front,
+    // a row's target never overlaps rows that have not been read yet.
+    for (idx_t seg_idx = segments_.size(); seg_idx-- > 0;) {
+        const auto& segment = segments_[seg_idx];
+        uint64_t end_row = seg_idx + 1 < segments_.size() ? segments_[seg_idx + 1].first_row : rows_written_;
+        uint64_t target_offset = data_location_ + segment.first_row * row_size;
+        if (segment.layout == layout_ && segment.file_offset == target_offset) {
+            continue;
+        }
+
+        uint64_t remaining = end_row - segment.first_row;
+        while (remaining > 0) {
+            idx_t count = MinValue<idx_t>(remaining, rows_per_pass);
+            uint64_t first = remaining - count;
+            ReadSegmentRows(segment, first, count, target);
+            file_.seekp(target_offset + first * row_size);
+            WriteBytes(target.data(), target.size());
+            if (!file_) {
+                throw IOException("Failed to write Stata file: " + filename_);
+            }
+            remaining = first;
+        }
+    }
+}
+
+void StataWriter::Finish() {
+    if (format_version_ < 118 && rows_written_ > NumericLimits<uint32_t>::Maximum()) {
+        throw InvalidInputException("Stata format %d supports at most %d observations, use version 118 or 119",
+                                    format_version_, NumericLimits<uint32_t>::Maximum());
+    }
+    RelayoutData();
+    // No more strLs to deduplicate; let the other writers of the COPY use the budget
+    ReleaseStrLIndex();
+
+    file_.seekp(data_location_ + rows_written_ * layout_.row_size);
+    WriteTag("</data>");
+
+    section_map_[10] = GetPosition();
+    WriteTag("<strls>");
+    if (strls_file_) {
+        strls_stream_.close();
+        std::ifstream strls(strls_file_->GetPath(), std::ios::binary);
+        std::vector<char> buffer(1024 * 1024);
+        while (strls) {
+            strls.read(buffer.data(), buffer.size());
+            WriteBytes(buffer.data(), static_cast<size_t>(strls.gcount()));
+        }
+    }
+    WriteTag("</strls>");
+
+    section_map_[11] = GetPosition();
+    WriteTag("<value_labels>");
+    WriteValueLabels();
+    WriteTag("</value_labels>");
+
+    section_map_[12] = GetPosition();
+    WriteTag("</stata_dta>");
+    section_map_[13] = GetPosition();
+
+    // Patch what was only known at the end: the row count, the final storage
+    // types and formats, the section offsets and whether the rows were sorted
+    file_.seekp(nobs_position_);
+    WriteObsCount(rows_written_);
+    file_.seekp(section_map_[1] + std::strlen("<map>"));
+    for (auto offset : section_map_) {
+        WriteValue<uint64_t>(offset);
+    }
+    file_.seekp(section_map_[2] + std::strlen("<variable_types>"));
+    WriteVariableTypes();
+    file_.seekp(section_map_[5] + std::strlen("<formats>"));
+    WriteFormats();
+    if (sort_holds_) {
+        file_.seekp(section_map_[4] + std::strlen("<sortlist>"));
+        WriteSortList();
+    }
+
+    file_.close();
+    if (!file_) {
+        throw IOException("Failed to write Stata file: " + filename_);
+    }
+    // Rows that shrank when a strN column became strL leave the old, longer data
+    // section behind the end of the file; cut it off after </stata_dta>
+    std::error_code error;
+    std::filesystem::resize_file(filename_, section_map_[13], error);
+    if (error) {
+        throw IOException("Failed to truncate Stata file \"%s\": %s", filename_, error.message());
+    }
+}
+
+} // namespace duckdb
@@ -6,6 +6,8 @@ Generate test Stata DTA files for testing the DuckDB extension
 import pandas as pd
 import numpy as np
 import os
+import gzip
+import struct
 from pathlib import Path
 
 def create_test_files():
@@ -95,11 +97,115 @@ def create_test_files():
     df_special.to_stata(test_dir / "special_chars.dta", version=114)
     print("Created special_chars.dta")
     
+    # Test 9: strL columns (long strings stored in the <strls> section after the data)
+    create_strl_files(test_dir)
+    
+    # Test 10: Variable labels, value labels and a data label
+    create_labelled_files(test_dir)
+    
+    create_compressed_files(test_dir)
+    
     print(f"\nAll test files created in: {test_dir}")
     print("Files created:")
     for dta_file in sorted(test_dir.glob("*.dta")):
         size = dta_file.stat().st_size
         print(f"  {dta_file.name} ({size} bytes)")
 
+def create_strl_files(test_dir):
+    """Create version 117 and 118 files with a strL column, plus a gzip copy read forward-only"""
+    df_strl = pd.DataFrame({
+        'id': [1, 2, 3, 4],
+        'note': ['short', 'x' * 3000, '', 'short'],
+        'tag': ['a', 'b', 'c', 'd']
+    })
+    for version in [117, 118]:
+        df_strl.to_stata(test_dir / f"strl_{version}.dta", version=version, convert_strl=['note'],
+                         write_index=False)
+        print(f"Created strl_{version}.dta")
+    raw = (test_dir / "strl_118.dta").read_bytes()
+    (test_dir / "strl_118.dta.gz").write_bytes(gzip.compress(raw, mtime=0))
+    print("Created strl_118.dta.gz")
+
+def create_labelled_files(test_dir):
+    """Create version 114 and 118 files with variable labels and value labels"""
+    df_labelled = pd.DataFrame({
+        'id': [1, 2, 3],
+        'sex': [1, 2, 1],
+        'region': [10, 20, 30],
+        'income': [1000.5, 2000.25, None]
+    })
+    df_labelled = df_labelled.astype({'id': 'int32', 'sex': 'int8', 'region': 'int16'})
+    for version in [114, 118]:
+        df_labelled.to_stata(
+            test_dir / f"labelled_{version}.dta", version=version, write_index=False,
+            data_label="Household survey",
+            variable_labels={'id': 'Household id', 'sex': 'Sex of head', 'income': 'Monthly income'},
+            value_labels={'sex': {1: 'male', 2: 'female'}, 'region': {10: 'North', 20: 'South', 30: 'East'}})
+        add_characteristics(test_dir / f"labelled_{version}.dta", version, [
+            ('_dta', 'note0', '1'),
+            ('_dta', 'note1', 'Collected in 2024'),
+            ('income', 'note1', 'Self reported'),
+        ])
+        print(f"Created labelled_{version}.dta")
+
+def add_characteristics(path, version, characteristics):
+    """Insert characteristics (variable, name, contents), which pandas cannot write"""
+    raw = path.read_bytes()
+    name_width = 129 if version >= 118 else 33
+    def entry(variable, name, contents):
+        return (variable.encode().ljust(name_width, b"\0") + name.encode().ljust(name_width, b"\0")
+                + contents.encode() + b"\0")
+    if version >= 117:
+        section = b"".join(
+            b"<ch>" + struct.pack("<I", len(body)) + body + b"</ch>"
+            for body in (entry(*c) for c in characteristics))
+        position = raw.index(b"</characteristics>")
+        # Sections after <characteristics> move; shift their offsets in the map
+        map_start = raw.index(b"<map>") + 5
+        offsets = list(struct.unpack("<14Q", raw[map_start:map_start + 112]))
+        offsets[9:] = [offset + len(section) for offset in offsets[9:]]
+        raw = raw[:map_start] + struct.pack("<14Q", *offsets) + raw[map_start + 112:]
+    else:
+        # Expansion fields of type 1 before the terminating empty field
+        section = b"".join(
+            struct.pack("<BI", 1, len(body)) + body for body in (entry(*c) for c in characteristics))
+        nvar = struct.unpack("<H", raw[4:6])[0]
+        position = 109 + nvar * (1 + 33 + 2 + 49 + 33 + 81) + 2
+    path.write_bytes(raw[:position] + section + raw[position:])
+
+def create_compressed_files(test_dir, block_size=32 * 1024):
+    """Create gzip and zstd copies of existing test files, including indexed/seekable variants"""
+    import zstandard
+    
+    # Plain single-stream compression (forward-only reading)
+    for name in ["simple.dta", "version_118.dta"]:
+        raw = (test_dir / name).read_bytes()
+        (test_dir / f"{name}.gz").write_bytes(gzip.compress(raw, mtime=0))
+        (test_dir / f"{name}.zst").write_bytes(zstandard.ZstdCompressor().compress(raw))
+        print(f"Created {name}.gz and {name}.zst")
+    
+    raw = (test_dir / "large_dataset.dta").read_bytes()
+    blocks = [raw[i:i + block_size] for i in range(0, len(raw), block_size)]
+    
+    # Multi-member gzip with a bgzip-style .gzi index of member boundaries
+    members = [gzip.compress(block, mtime=0) for block in blocks]
+    index = []
+    compressed_offset = 0
+    for i, member in enumerate(members[:-1]):
+        compressed_offset += len(member)
+        index.append((compressed_offset, (i + 1) * block_size))
+    (test_dir / "large_dataset.dta.gz").write_bytes(b"".join(members))
+    (test_dir / "large_dataset.dta.gz.gzi").write_bytes(
+        struct.pack("<Q", len(index)) + b"".join(struct.pack("<QQ", c, u) for c, u in index))
+    print("Created large_dataset.dta.gz and large_dataset.dta.gz.gzi")
+    
+    # zstd seekable format: independent frames followed by a seek table skippable frame
+    frames = [zstandard.ZstdCompressor().compress(block) for block in blocks]
+    entries = b"".join(struct.pack("<II", len(frame), len(block)) for frame, block in zip(frames, blocks))
+    footer = struct.pack("<IBI", len(frames), 0, 0x8F92EAB1)
+    seek_table = struct.pack("<II", 0x184D2A5E, len(entries) + len(footer)) + entries + footer
+    (test_dir / "large_dataset.dta.zst").write_bytes(b"".join(frames) + seek_table)
+    print("Created large_dataset.dta.zst (seekable)")
+
 if __name__ == "__main__":
     create_test_files()
\ No newline at end of file